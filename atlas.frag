@@ -0,0 +1,9 @@
+#version 330 core
+out vec4 FragColor;
+in vec3 AtlasCoord;
+uniform sampler2DArray atlas;
+
+void main()
+{
+    FragColor = texture(atlas, AtlasCoord);
+};
@@ -0,0 +1,927 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+#include <Eigen/Dense>
+#include "shader.h"
+#include "instanced_mesh.h"
+#include "stream_buffer.h"
+#include "pixel_upload.h"
+#include "job_system.h"
+#include "mipmap.h"
+#include "image_decode.h"
+#include "image_probe.h"
+#include "texture.h"
+#include "block_compress.h"
+#include "texture_cache.h"
+#include "texture_atlas.h"
+#include "transform_batch.h"
+#include "frustum_cull.h"
+#include "scene_graph.h"
+#include "bvh.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Benchmarks run by starting the program with --bench. They need the GL context and the
+// resources main() sets up, and print one line per case.
+
+class BenchmarkTimer
+{
+public:
+    BenchmarkTimer() : start(std::chrono::steady_clock::now()) {}
+    double milliseconds() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// N glDrawElements with a model uniform each vs one instanced draw of the same N transforms,
+// uploaded with glBufferSubData or written into a StreamBuffer. Everything is timed to
+// glFinish so the GPU side is included.
+// The camera comes from the frame constants, which must be up to date.
+inline void BenchmarkInstancing(Shader& perDraw, Shader& instanced, GLuint vertexArray, InstancedMesh& mesh)
+{
+    constexpr int frames = 10;
+    const UniformHandle model = perDraw.getUniform("model");
+    constexpr int maxCount = 50000;
+    StreamBuffer stream(GL_ARRAY_BUFFER, maxCount * sizeof(Eigen::Matrix4f));
+    std::printf("instancing: %d frames each, stream buffer %s\n", frames,
+                stream.isPersistent() ? "persistent" : "map unsynchronized");
+    for (int count : { 100, 1000, 10000, maxCount })
+    {
+        // a grid of small quads in front of the camera
+        std::vector<Eigen::Matrix4f> transforms(count);
+        const int side = (int)std::ceil(std::sqrt((float)count));
+        for (int i = 0; i < count; i++)
+        {
+            Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+            transform.block<3, 3>(0, 0) *= 2.0f / side;
+            transform(0, 3) = -1.0f + 2.0f * (i % side + 0.5f) / side;
+            transform(1, 3) = -1.0f + 2.0f * (i / side + 0.5f) / side;
+            transforms[i] = transform;
+        }
+
+        glFinish();
+        BenchmarkTimer drawsTimer;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            perDraw.use();
+            glState.bindVertexArray(vertexArray);
+            for (const auto& transform : transforms)
+            {
+                perDraw.setMat4f(model, transform);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            }
+        }
+        glFinish();
+        const double draws = drawsTimer.milliseconds() / frames;
+
+        BenchmarkTimer instancedTimer;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            instanced.use();
+            mesh.setInstances(transforms.data(), transforms.size());
+            mesh.draw();
+        }
+        glFinish();
+        const double batched = instancedTimer.milliseconds() / frames;
+
+        BenchmarkTimer streamedTimer;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            stream.beginFrame();
+            const size_t bytes = transforms.size() * sizeof(Eigen::Matrix4f);
+            const StreamAllocation allocation = stream.allocate(bytes, sizeof(Eigen::Matrix4f));
+            memcpy(allocation.data, transforms.data(), bytes);
+            stream.commit();
+            instanced.use();
+            mesh.setInstances(stream.buffer(), allocation.offset, transforms.size());
+            mesh.draw();
+        }
+        glFinish();
+        const double streamed = streamedTimer.milliseconds() / frames;
+
+        std::printf("  %6d quads  draws %8.3f ms  instanced %8.3f ms  streamed %8.3f ms  speedup %6.1fx\n",
+                    count, draws, batched, streamed, draws / batched);
+    }
+}
+
+// Main thread cost of getting RGBA8 pixels into a texture: glTexSubImage2D straight from client
+// memory vs a PixelUploadBuffer filled by a worker. The main thread column is what the render
+// loop would pay, the finish column includes the transfer up to glFinish.
+inline void BenchmarkTextureUpload(JobSystem& jobs)
+{
+    constexpr int repeats = 8;
+    PixelUploadBuffer pixelBuffer(64 << 20);
+    std::printf("texture upload: %d uploads each, upload buffer %s\n", repeats,
+                pixelBuffer.isPersistent() ? "persistent" : "map unsynchronized");
+    for (int size : { 512, 1024, 2048 })
+    {
+        const size_t bytes = (size_t)size * size * 4;
+        std::vector<unsigned char> pixels(bytes);
+        for (size_t i = 0; i < bytes; i++)
+            pixels[i] = (unsigned char)(i * 7);
+        const double megabytes = bytes / (1024.0 * 1024.0) * repeats;
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glFinish();
+
+        double clientMain = 0.0;
+        BenchmarkTimer clientTimer;
+        for (int i = 0; i < repeats; i++)
+        {
+            BenchmarkTimer call;
+            glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            clientMain += call.milliseconds();
+        }
+        glFinish();
+        const double clientFinish = clientTimer.milliseconds();
+
+        double bufferMain = 0.0;
+        BenchmarkTimer bufferTimer;
+        for (int i = 0; i < repeats; i++)
+        {
+            BenchmarkTimer reserve;
+            const PixelUploadRegion region = pixelBuffer.reserve(bytes);
+            bufferMain += reserve.milliseconds();
+            if (!region.valid())
+                break;
+            // the render loop would get on with the frame here, the benchmark just waits
+            std::atomic<bool> filled{ false };
+            jobs.submit([&]
+            {
+                memcpy(region.data, pixels.data(), bytes);
+                filled.store(true, std::memory_order_release);
+            });
+            while (!filled.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            BenchmarkTimer call;
+            glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+            pixelBuffer.upload(region, GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE);
+            bufferMain += call.milliseconds();
+        }
+        glFinish();
+        const double bufferFinish = bufferTimer.milliseconds();
+        glState.deleteTexture(texture);
+
+        std::printf("  %4dx%-4d  client %7.3f ms/MB main, %7.3f ms/MB finish   upload buffer %7.3f ms/MB main, %7.3f ms/MB finish\n",
+                    size, size, clientMain / megabytes, clientFinish / megabytes,
+                    bufferMain / megabytes, bufferFinish / megabytes);
+    }
+}
+
+// Mip chain on the CPU: the scalar reference vs the SIMD kernels for both filters, next to
+// glGenerateMipmap timed to glFinish. The sample textures, then uv.jpg tiled up to 8K.
+inline void BenchmarkMipmaps()
+{
+    struct Input
+    {
+        const char* name = nullptr;
+        int width = 0, height = 0, channels = 0;
+        std::vector<unsigned char> pixels = {};
+    };
+    std::vector<Input> inputs;
+    for (const char* name : { "face.png", "uv.jpg", "checkerboard.png" })
+    {
+        Input input{ name };
+        unsigned char* data = DecodeImageFile(name, ImageDecodeOptions{}, &input.width, &input.height, &input.channels);
+        if (!data)
+            continue;
+        input.pixels.assign(data, data + (size_t)input.width * input.height * input.channels);
+        stbi_image_free(data);
+        inputs.push_back(std::move(input));
+    }
+    for (int size : { 4096, 8192 })
+    {
+        if (inputs.size() < 2)
+            break;
+        const Input& tile = inputs[1];
+        Input input{ size == 4096 ? "uv.jpg x16" : "uv.jpg x64", size, size, tile.channels };
+        input.pixels.resize((size_t)size * size * tile.channels);
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++)
+                memcpy(&input.pixels[((size_t)y * size + x) * tile.channels],
+                       &tile.pixels[((size_t)(y % tile.height) * tile.width + x % tile.width) * tile.channels], tile.channels);
+        inputs.push_back(std::move(input));
+    }
+
+    std::printf("mipmaps: reference vs SIMD, sRGB averaging\n");
+    for (const Input& input : inputs)
+    {
+        for (MipFilter filter : { MipFilter::Box, MipFilter::Kaiser })
+        {
+            MipmapOptions options;
+            options.filter = filter;
+            options.srgb = true;
+            MipChainBuilder reference(input.channels, options, false), vectorized(input.channels, options, true);
+            BenchmarkTimer referenceTimer;
+            const std::vector<MipLevel> expected = reference.build(input.pixels.data(), input.width, input.height);
+            const double referenceMs = referenceTimer.milliseconds();
+            BenchmarkTimer vectorizedTimer;
+            const std::vector<MipLevel> levels = vectorized.build(input.pixels.data(), input.width, input.height);
+            const double vectorizedMs = vectorizedTimer.milliseconds();
+            int difference = 0;
+            for (size_t i = 0; i < levels.size(); i++)
+                for (size_t j = 0; j < levels[i].pixels.size(); j++)
+                    difference = std::max(difference, std::abs(levels[i].pixels[j] - expected[i].pixels[j]));
+            std::printf("  %-18s %4dx%-4d %-6s reference %8.2f ms  SIMD %8.2f ms  speedup %5.1fx  max difference %d\n",
+                        input.name, input.width, input.height, filter == MipFilter::Box ? "box" : "kaiser",
+                        referenceMs, vectorizedMs, referenceMs / vectorizedMs, difference);
+        }
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, InternalFormatForChannels(input.channels), input.width, input.height, 0,
+                     PixelFormatForChannels(input.channels), GL_UNSIGNED_BYTE, input.pixels.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glFinish();
+        BenchmarkTimer driverTimer;
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glFinish();
+        std::printf("  %-18s %4dx%-4d glGenerateMipmap %8.2f ms\n", input.name, input.width, input.height, driverTimer.milliseconds());
+        glState.deleteTexture(texture);
+    }
+}
+
+// BC1/BC3 encoding of the sample textures, level 0 only: the scalar reference vs the SIMD
+// palette fit, and the RMSE of the decoded blocks against the source.
+inline void BenchmarkBlockCompression()
+{
+    std::printf("block compression: reference vs SIMD\n");
+    for (const char* name : { "face.png", "uv.jpg", "checkerboard.png" })
+    {
+        int width, height, channels;
+        unsigned char* pixels = DecodeImageFile(name, ImageDecodeOptions{}, &width, &height, &channels);
+        if (!pixels)
+            continue;
+        const BlockFormat format = ChooseBlockFormat(pixels, width, height, channels);
+        BenchmarkTimer referenceTimer;
+        const std::vector<unsigned char> expected = BlockCompressor(false).compress(pixels, width, height, channels, format);
+        const double referenceMs = referenceTimer.milliseconds();
+        BenchmarkTimer vectorizedTimer;
+        const std::vector<unsigned char> blocks = BlockCompressor(true).compress(pixels, width, height, channels, format);
+        const double vectorizedMs = vectorizedTimer.milliseconds();
+
+        double squaredError = 0.0;
+        const size_t blockBytes = BlockBytes(format);
+        const unsigned char* block = blocks.data();
+        unsigned char texels[16][4];
+        for (int by = 0; by < height; by += 4)
+        {
+            for (int bx = 0; bx < width; bx += 4, block += blockBytes)
+            {
+                if (format == BlockFormat::BC3)
+                    BlockCompressor::DecompressAlphaBlock(block, texels);
+                BlockCompressor::DecompressColorBlock(block + blockBytes - 8, texels);
+                for (int i = 0; i < 16; i++)
+                {
+                    const int x = bx + (i & 3), y = by + (i >> 2);
+                    if (x >= width || y >= height)
+                        continue;
+                    const unsigned char* texel = pixels + ((size_t)y * width + x) * channels;
+                    for (int c = 0; c < std::min(channels, 3); c++)
+                        squaredError += (texel[c] - texels[i][c]) * (texel[c] - texels[i][c]);
+                }
+            }
+        }
+        const double rmse = std::sqrt(squaredError / ((double)width * height * std::min(channels, 3)));
+        std::printf("  %-18s %4dx%-4d %s reference %8.2f ms  SIMD %8.2f ms  speedup %5.1fx  color RMSE %5.2f  %s\n",
+                    name, width, height, format == BlockFormat::BC1 ? "BC1" : "BC3", referenceMs, vectorizedMs,
+                    referenceMs / vectorizedMs, rmse, blocks == expected ? "identical" : "DIFFERENT");
+        stbi_image_free(pixels);
+    }
+}
+
+// Residency under a budget: copies of uv loaded into a cache that only fits a few of them at
+// full size, and a window of textures drawn each frame that slides over them, so the ones
+// falling out are evicted and the ones coming in are streamed back from the source.
+inline void BenchmarkTextureCache(JobSystem& jobs)
+{
+    constexpr int textureCount = 16;
+    constexpr int window = 4;
+    constexpr int frames = 240;
+    TextureCache cache(jobs, (size_t)-1);
+    std::vector<unsigned int> textures;
+    for (int i = 0; i < textureCount; i++)
+        textures.push_back(cache.load("uv.jpg", false, "uv.tex"));
+    cache.finish();
+    const size_t fullBytes = cache.residentBytes() / textureCount;
+    // room for the window at full size and a bit, the rest has to sit at the low mip
+    cache.setBudget(fullBytes * (window + 1) + fullBytes / 2);
+
+    BenchmarkTimer timer;
+    uint32_t maxEvictions = 0;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        const int first = frame / 8;
+        for (int i = 0; i < window; i++)
+            cache.touch(textures[(first + i) % textureCount]);
+        cache.update();
+        maxEvictions = std::max(maxEvictions, cache.lastFrame().evictions);
+        // stands in for the rest of the frame
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    cache.finish();
+    const double milliseconds = timer.milliseconds();
+
+    const auto& totals = cache.totals();
+    std::printf("texture cache: %d textures of %zu KB, budget %zu KB, %d drawn per frame, %d frames in %.1f ms\n",
+                textureCount, fullBytes / 1024, cache.budgetBytes() / 1024, window, frames, milliseconds);
+    std::printf("  resident %zu KB  evictions %.2f/frame (max %u)  stream-ins %u, %zu KB  stream-in latency %.2f ms average, %.2f ms max\n",
+                cache.residentBytes() / 1024, (double)totals.evictions / frames, maxEvictions, totals.streamIns,
+                totals.streamedBytes / 1024, cache.averageStreamInMilliseconds(), cache.maxStreamInMilliseconds());
+}
+
+// Quads that each show one of many small images: a texture per image and a bind, a model
+// uniform and a draw per quad, vs the images packed into an atlas array and every quad in one
+// instanced draw. Also the packing time and how full the pages end up.
+// The camera comes from the frame constants, which must be up to date.
+inline void BenchmarkAtlas(Shader& perDraw, Shader& atlasProgram, GLuint vertexArray, InstancedMesh& mesh)
+{
+    constexpr int imageCount = 256;
+    constexpr int frames = 10;
+    std::vector<std::vector<unsigned char>> images(imageCount);
+    std::vector<int> sizes(imageCount);
+    for (int i = 0; i < imageCount; i++)
+    {
+        // 16 to 128 texels a side, stripes in a color of their own
+        const int size = 16 << (i % 4);
+        sizes[i] = size;
+        images[i].resize((size_t)size * size * 4);
+        for (int t = 0; t < size * size; t++)
+        {
+            unsigned char* texel = images[i].data() + (size_t)t * 4;
+            const bool stripe = ((t % size) / 4 + (t / size) / 4) % 2 == 0;
+            texel[0] = (unsigned char)(i * 37);
+            texel[1] = (unsigned char)(i * 91);
+            texel[2] = stripe ? 255 : 0;
+            texel[3] = 255;
+        }
+    }
+
+    BenchmarkTimer packTimer;
+    TextureAtlasBuilder builder(1024, 8);
+    for (int i = 0; i < imageCount; i++)
+        builder.add(images[i].data(), sizes[i], sizes[i], 4);
+    builder.build();
+    const double packMs = packTimer.milliseconds();
+    const GLuint atlas = builder.upload();
+    std::printf("atlas: %d images into %d %dx%d layers, %d levels, %.0f%% occupied, packed and mipmapped in %.2f ms\n",
+                imageCount, builder.layerCount(), builder.pageSize(), builder.pageSize(), builder.levelCount(),
+                builder.pageOccupancy() * 100.0f, packMs);
+
+    std::vector<GLuint> textures(imageCount);
+    glGenTextures(imageCount, textures.data());
+    for (int i = 0; i < imageCount; i++)
+    {
+        glState.bindTextureForUpdate(GL_TEXTURE_2D, textures[i]);
+        SetDefaultTextureParameters();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, sizes[i], sizes[i], 0, GL_RGBA, GL_UNSIGNED_BYTE, images[i].data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    const UniformHandle model = perDraw.getUniform("model");
+    GLuint entryBuffer;
+    glGenBuffers(1, &entryBuffer);
+    for (int count : { 1000, 10000 })
+    {
+        std::vector<Eigen::Matrix4f> transforms(count);
+        std::vector<AtlasEntry> entries(count);
+        const int side = (int)std::ceil(std::sqrt((float)count));
+        for (int i = 0; i < count; i++)
+        {
+            Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+            transform.block<3, 3>(0, 0) *= 2.0f / side;
+            transform(0, 3) = -1.0f + 2.0f * (i % side + 0.5f) / side;
+            transform(1, 3) = -1.0f + 2.0f * (i / side + 0.5f) / side;
+            transforms[i] = transform;
+            entries[i] = builder.entries()[i % imageCount];
+        }
+
+        glFinish();
+        BenchmarkTimer drawsTimer;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            perDraw.use();
+            glState.bindVertexArray(vertexArray);
+            for (int i = 0; i < count; i++)
+            {
+                glState.bindTexture(0, GL_TEXTURE_2D, textures[i % imageCount]);
+                perDraw.setMat4f(model, transforms[i]);
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+            }
+        }
+        glFinish();
+        const double draws = drawsTimer.milliseconds() / frames;
+
+        glState.bindBuffer(GL_ARRAY_BUFFER, entryBuffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(AtlasEntry) * entries.size(), entries.data(), GL_STATIC_DRAW);
+        AttachAtlasInstances(mesh.vertexArrayObject(), entryBuffer);
+        BenchmarkTimer atlasTimer;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            atlasProgram.use();
+            glState.bindTexture(0, GL_TEXTURE_2D_ARRAY, atlas);
+            mesh.setInstances(transforms.data(), transforms.size());
+            mesh.draw();
+        }
+        glFinish();
+        const double batched = atlasTimer.milliseconds() / frames;
+
+        std::printf("  %6d quads  texture per image %8.3f ms  atlas %8.3f ms  speedup %6.1fx\n",
+                    count, draws, batched, draws / batched);
+    }
+
+    // the mesh's VAO goes back to plain instancing
+    glState.bindVertexArray(mesh.vertexArrayObject());
+    glDisableVertexAttribArray(7);
+    glDisableVertexAttribArray(8);
+    glState.deleteBuffer(entryBuffer);
+    for (GLuint texture : textures)
+        glState.deleteTexture(texture);
+    glState.deleteTexture(atlas);
+}
+
+// stb_image's JPEG decoder with its SSE2 kernels vs the AVX2 ones, which only exist for the
+// color conversion and the h2v2 upsampler; the Huffman decode and the IDCT are the same either
+// way. The output has to come out identical.
+inline void BenchmarkJpegDecode()
+{
+    constexpr int repeats = 10;
+    std::vector<unsigned char> bytes;
+    if (!ReadFileBytes("uv.jpg", bytes))
+        return;
+    std::printf("jpeg decode: uv.jpg, %d decodes each\n", repeats);
+    for (int channels : { 3, 4 })
+    {
+        double milliseconds[2];
+        std::vector<unsigned char> results[2];
+        int width = 0, height = 0;
+        for (int avx2 = 0; avx2 < 2; avx2++)
+        {
+            stbi_set_jpeg_avx2_thread(avx2);
+            ImageDecodeOptions options;
+            options.desiredChannels = channels;
+            BenchmarkTimer timer;
+            for (int i = 0; i < repeats; i++)
+            {
+                int fileChannels;
+                unsigned char* pixels = DecodeImage(bytes.data(), bytes.size(), options, &width, &height, &fileChannels);
+                if (!pixels)
+                    return;
+                if (i == repeats - 1)
+                    results[avx2].assign(pixels, pixels + (size_t)width * height * channels);
+                stbi_image_free(pixels);
+            }
+            milliseconds[avx2] = timer.milliseconds() / repeats;
+        }
+        stbi_set_jpeg_avx2_thread(1);
+        std::printf("  %d channels  SSE2 %7.2f ms  AVX2 %7.2f ms  speedup %4.2fx  %s\n", channels, milliseconds[0],
+                    milliseconds[1], milliseconds[0] / milliseconds[1],
+                    results[0] == results[1] ? "identical" : "DIFFERENT");
+    }
+}
+
+// stb_image's PNG decoder undoing the row filters in C vs with SSE2. Inflate is the same either
+// way and usually the bigger half, so the SSE2 filters also run pipelined behind inflate on a
+// thread of its own. The output has to come out identical.
+inline void BenchmarkPngDecode()
+{
+    constexpr int repeats = 10;
+    std::printf("png decode: %d decodes each\n", repeats);
+    for (const char* name : { "face.png", "checkerboard.png" })
+    {
+        std::vector<unsigned char> bytes;
+        if (!ReadFileBytes(name, bytes))
+            continue;
+        // the C loops, the SSE2 filters, and those with inflate on a thread of its own
+        double milliseconds[3];
+        std::vector<unsigned char> results[3];
+        int width = 0, height = 0, channels = 0;
+        for (int mode = 0; mode < 3; mode++)
+        {
+            stbi_set_png_simd_thread(mode > 0);
+            stbi_set_png_pipeline_thread(mode == 2 ? 1 : 0);
+            BenchmarkTimer timer;
+            for (int i = 0; i < repeats; i++)
+            {
+                unsigned char* pixels = DecodeImage(bytes.data(), bytes.size(), ImageDecodeOptions{}, &width, &height, &channels);
+                if (!pixels)
+                    return;
+                if (i == repeats - 1)
+                    results[mode].assign(pixels, pixels + (size_t)width * height * channels);
+                stbi_image_free(pixels);
+            }
+            milliseconds[mode] = timer.milliseconds() / repeats;
+        }
+        stbi_set_png_simd_thread(1);
+        stbi_set_png_pipeline_thread(0);
+        std::printf("  %-18s %4dx%-4d %d channels  C %7.2f ms  SSE2 %7.2f ms  speedup %4.2fx  pipelined %7.2f ms  %s\n", name,
+                    width, height, channels, milliseconds[0], milliseconds[1], milliseconds[0] / milliseconds[1], milliseconds[2],
+                    results[0] == results[1] && results[0] == results[2] ? "identical" : "DIFFERENT");
+    }
+}
+
+// Decoding a flipped image into memory that is already there (standing in for a mapped pixel
+// buffer): stbi_load_from_memory, which allocates the image, flips it in a second pass and
+// leaves a copy to the caller, vs an ImageDecoder writing the final rows straight into place
+// and reusing its scratch between decodes. The output has to come out identical.
+inline void BenchmarkDecodeInto()
+{
+    constexpr int repeats = 10;
+    std::printf("decode into: flipped, 4 channels, %d decodes each\n", repeats);
+    ImageDecoder decoder;
+    for (const char* name : { "uv.jpg", "face.png", "checkerboard.png" })
+    {
+        std::vector<unsigned char> bytes;
+        if (!ReadFileBytes(name, bytes))
+            continue;
+        ImageDecodeOptions options;
+        options.flipVertically = true;
+        options.desiredChannels = 4;
+        int width, height, channels;
+        const size_t size = ImageDecoder::DecodedSize(bytes.data(), bytes.size(), options, &width, &height, &channels);
+        if (size == 0)
+            continue;
+        std::vector<unsigned char> results[2] = { std::vector<unsigned char>(size), std::vector<unsigned char>(size) };
+
+        BenchmarkTimer copyTimer;
+        for (int i = 0; i < repeats; i++)
+        {
+            unsigned char* pixels = DecodeImage(bytes.data(), bytes.size(), options, &width, &height, &channels);
+            if (!pixels)
+                return;
+            memcpy(results[0].data(), pixels, size);
+            stbi_image_free(pixels);
+        }
+        const double copied = copyTimer.milliseconds() / repeats;
+
+        BenchmarkTimer intoTimer;
+        for (int i = 0; i < repeats; i++)
+            if (!decoder.decodeInto(bytes.data(), bytes.size(), options, results[1].data(), size, &width, &height, &channels))
+                return;
+        const double into = intoTimer.milliseconds() / repeats;
+
+        std::printf("  %-18s %4dx%-4d  allocate, flip, copy %7.2f ms  into %7.2f ms  speedup %4.2fx  %s\n", name, width,
+                    height, copied, into, copied / into, results[0] == results[1] ? "identical" : "DIFFERENT");
+    }
+    std::printf("  scratch kept by the decoder %.1f MB of %.1f MB allowed\n", decoder.retainedBytes() / (1024.0 * 1024.0),
+                ImageScratchPool::DEFAULT_MAX_BYTES / (1024.0 * 1024.0));
+    decoder.trim();
+    std::printf("  after trim %.1f MB\n", decoder.retainedBytes() / (1024.0 * 1024.0));
+}
+
+// What the header probe costs next to the decode it lets the layout run ahead of.
+inline void BenchmarkImageProbe()
+{
+    constexpr int repeats = 10;
+    const char* names[] = { "uv.jpg", "face.png", "checkerboard.png" };
+    std::printf("image probe: %d probes and decodes each\n", repeats);
+    ImageIndex index;
+    BenchmarkTimer indexTimer;
+    for (const char* name : names)
+        index.add(name);
+    std::printf("  index of %zu images built in %.3f ms\n", index.size(), indexTimer.milliseconds());
+    for (const char* name : names)
+    {
+        std::vector<unsigned char> bytes;
+        const ImageProbe* probe = index.find(name);
+        if (!probe || !probe->valid() || !ReadFileBytes(name, bytes))
+            continue;
+        BenchmarkTimer probeTimer;
+        for (int i = 0; i < repeats; i++)
+            ProbeImage(bytes.data(), bytes.size());
+        const double probed = probeTimer.milliseconds() / repeats;
+        BenchmarkTimer decodeTimer;
+        bool matches = true;
+        for (int i = 0; i < repeats; i++)
+        {
+            int width, height, channels;
+            unsigned char* pixels = DecodeImage(bytes.data(), bytes.size(), ImageDecodeOptions{}, &width, &height, &channels);
+            matches = matches && pixels && width == probe->width && height == probe->height && channels == probe->channels;
+            stbi_image_free(pixels);
+        }
+        const double decoded = decodeTimer.milliseconds() / repeats;
+        std::printf("  %-18s %4dx%-4d %d channels %2d bit%s  probe %7.4f ms  decode %7.2f ms  %s\n", name,
+                    probe->width, probe->height, probe->channels, probe->bitsPerChannel, probe->hdr ? " hdr" : "",
+                    probed, decoded, matches ? "matches" : "DIFFERENT");
+    }
+}
+
+// World and MVP matrices for many objects: Eigen one object at a time vs the batched SoA kernel
+// with scalar lanes, with SIMD lanes, and with SIMD lanes across the job system's threads.
+// The difference column is the largest deviation of any MVP element from Eigen's.
+inline void BenchmarkTransforms(JobSystem& jobs)
+{
+    constexpr int repeats = 5;
+    std::printf("transforms: %d runs each, %u worker threads\n", repeats, jobs.threadCount());
+    const Eigen::Matrix4f viewProjection = GetMatPerspectiveProjection(0.8f, 1.5f, 0.1f, 100.0f) *
+                                           GetLookAtMat(Eigen::Vector3f(0, 2, 5), Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(0, 1, 0));
+    for (size_t count : { (size_t)10000, (size_t)100000, (size_t)1000000 })
+    {
+        TransformBatch batch;
+        batch.resize(count);
+        std::vector<Eigen::Vector3f> positions(count), scales(count);
+        std::vector<Eigen::Quaternionf> rotations(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const float f = (float)i;
+            positions[i] = Eigen::Vector3f(std::sin(f) * 50.0f, std::cos(f * 0.7f) * 50.0f, std::sin(f * 1.3f) * 50.0f);
+            rotations[i] = Eigen::Quaternionf(Eigen::AngleAxisf(f * 0.01f, Eigen::Vector3f(std::sin(f), 1.0f, std::cos(f)).normalized()));
+            scales[i] = Eigen::Vector3f(1.0f + (i % 3), 1.0f + (i % 5) * 0.5f, 1.0f + (i % 7) * 0.25f);
+            batch.set(i, positions[i], rotations[i], scales[i]);
+        }
+
+        std::vector<Eigen::Matrix4f> eigenWorld(count), eigenMvp(count);
+        BenchmarkTimer eigenTimer;
+        for (int run = 0; run < repeats; run++)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                Eigen::Matrix4f world = Eigen::Matrix4f::Identity();
+                world.block<3, 3>(0, 0) = rotations[i].toRotationMatrix() * scales[i].asDiagonal();
+                world.block<3, 1>(0, 3) = positions[i];
+                eigenWorld[i] = world;
+                eigenMvp[i] = viewProjection * world;
+            }
+        }
+        const double eigen = eigenTimer.milliseconds() / repeats;
+
+        std::vector<float> world(count * 16), mvp(count * 16);
+        BenchmarkTimer scalarTimer;
+        for (int run = 0; run < repeats; run++)
+            ComputeTransformRange(batch, 0, count, viewProjection, world.data(), mvp.data(), false);
+        const double scalar = scalarTimer.milliseconds() / repeats;
+        BenchmarkTimer simdTimer;
+        for (int run = 0; run < repeats; run++)
+            ComputeTransformRange(batch, 0, count, viewProjection, world.data(), mvp.data());
+        const double simd = simdTimer.milliseconds() / repeats;
+        BenchmarkTimer threadedTimer;
+        for (int run = 0; run < repeats; run++)
+            ComputeTransforms(jobs, batch, viewProjection, world.data(), mvp.data());
+        const double threaded = threadedTimer.milliseconds() / repeats;
+
+        float difference = 0.0f;
+        for (size_t i = 0; i < count; i++)
+        {
+            for (int k = 0; k < 16; k++)
+            {
+                difference = std::max(difference, std::abs(world[i * 16 + k] - eigenWorld[i].data()[k]));
+                difference = std::max(difference, std::abs(mvp[i * 16 + k] - eigenMvp[i].data()[k]));
+            }
+        }
+        std::printf("  %7zu objects  Eigen %8.3f ms  scalar %8.3f ms  SIMD %8.3f ms  threaded %8.3f ms  speedup %5.1fx  difference %g\n",
+                    count, eigen, scalar, simd, threaded, eigen / threaded, difference);
+    }
+}
+
+// Frustum culling of spheres and boxes scattered around the camera: one object at a time, SIMD
+// lanes on one thread, and a FrustumCuller spreading SIMD lanes across the job system. The
+// visible lists have to match.
+inline void BenchmarkCulling(JobSystem& jobs)
+{
+    constexpr int repeats = 5;
+    std::printf("culling: %d runs each, %u worker threads\n", repeats, jobs.threadCount());
+    const Frustum frustum = ExtractFrustum(GetMatPerspectiveProjection(0.8f, 1.5f, 0.1f, 100.0f) *
+                                           GetLookAtMat(Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(0, 0, -1), Eigen::Vector3f(0, 1, 0)));
+    FrustumCuller culler(jobs);
+    for (size_t count : { (size_t)100000, (size_t)1000000, (size_t)4000000 })
+    {
+        SphereBatch spheres;
+        BoxBatch boxes;
+        spheres.resize(count);
+        boxes.resize(count);
+        uint32_t seed = 12345;
+        auto random = [&seed] { seed = seed * 1664525u + 1013904223u; return (float)(seed >> 8) / (1 << 24); };
+        for (size_t i = 0; i < count; i++)
+        {
+            const Eigen::Vector3f center(random() * 200.0f - 100.0f, random() * 200.0f - 100.0f, random() * 200.0f - 100.0f);
+            const Eigen::Vector3f extent(random() + 0.1f, random() + 0.1f, random() + 0.1f);
+            spheres.set(i, center, extent.norm());
+            boxes.set(i, center - extent, center + extent);
+        }
+
+        auto time = [](auto&& pass)
+        {
+            BenchmarkTimer timer;
+            for (int run = 0; run < repeats; run++)
+                pass();
+            return timer.milliseconds() / repeats;
+        };
+        for (int shape = 0; shape < 2; shape++)
+        {
+            auto cull = [&]() -> const std::vector<uint32_t>&
+            {
+                return shape == 0 ? culler.cull(frustum, spheres) : culler.cull(frustum, boxes);
+            };
+            std::vector<uint32_t> visible(count);
+            auto cullRange = [&](bool vectorized)
+            {
+                return shape == 0 ? CullRange(frustum, spheres, 0, count, visible.data(), vectorized)
+                                  : CullRange(frustum, boxes, 0, count, visible.data(), vectorized);
+            };
+            const double scalar = time([&] { cullRange(false); });
+            const std::vector<uint32_t> expected(visible.begin(), visible.begin() + cullRange(false));
+            const double simd = time([&] { cullRange(true); });
+            const bool simdSame = cullRange(true) == expected.size() && std::equal(expected.begin(), expected.end(), visible.begin());
+            const double threaded = time(cull);
+            const bool same = simdSame && cull() == expected;
+            std::printf("  %7zu %s  scalar %8.3f ms  SIMD %8.3f ms  threaded %8.3f ms  speedup %5.1fx  %zu visible, %zu culled  %s\n",
+                        count, shape == 0 ? "spheres" : "boxes  ", scalar, simd, threaded, scalar / threaded, expected.size(),
+                        count - expected.size(), same ? "identical" : "DIFFERENT");
+        }
+    }
+}
+
+// A scene graph of 100-node trees (a root, 9 children, 90 grandchildren) where 1% of the nodes
+// move each frame: recomputing every world matrix vs only the subtrees under the moved nodes.
+// The difference column compares the dirty updated matrices with a full recompute.
+inline void BenchmarkSceneGraph(JobSystem& jobs)
+{
+    constexpr int frames = 20;
+    std::printf("scene graph: %d frames each, 1%% of the nodes moving, %u worker threads\n", frames, jobs.threadCount());
+    for (size_t count : { (size_t)10000, (size_t)100000 })
+    {
+        const size_t trees = count / 100;
+        SceneGraph scene;
+        std::vector<uint32_t> nodes;
+        // a level at a time, so the first update has to sort the nodes depth first
+        for (size_t tree = 0; tree < trees; tree++)
+            nodes.push_back(scene.add(SceneGraph::NO_PARENT, Eigen::Vector3f((float)tree, 0, 0)));
+        for (size_t tree = 0; tree < trees; tree++)
+            for (int child = 0; child < 9; child++)
+                nodes.push_back(scene.add(nodes[tree], Eigen::Vector3f(0, (float)child, 0), Eigen::Quaternionf::Identity(),
+                                          Eigen::Vector3f::Constant(0.9f)));
+        for (size_t parent = trees; parent < trees * 10; parent++)
+            for (int child = 0; child < 10; child++)
+                nodes.push_back(scene.add(nodes[parent], Eigen::Vector3f(0, 0, (float)child)));
+        BenchmarkTimer sortTimer;
+        scene.update(jobs);
+        const double sort = sortTimer.milliseconds();
+
+        BenchmarkTimer fullTimer;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            scene.invalidate();
+            scene.update(jobs);
+        }
+        const double full = fullTimer.milliseconds() / frames;
+
+        uint32_t seed = 1;
+        size_t recomputed = 0;
+        BenchmarkTimer dirtyTimer;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            for (size_t moved = 0; moved < count / 100; moved++)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                const float angle = (float)(seed >> 8) / (float)(1 << 24) * 3.0f;
+                scene.setRotation(nodes[(seed >> 4) % nodes.size()], Eigen::Quaternionf(Eigen::AngleAxisf(angle, Eigen::Vector3f::UnitY())));
+            }
+            scene.update(jobs);
+            recomputed += scene.lastUpdated();
+        }
+        const double dirty = dirtyTimer.milliseconds() / frames;
+
+        std::vector<Eigen::Matrix4f> updated(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+            updated[i] = scene.world(nodes[i]);
+        scene.invalidate();
+        scene.update(jobs);
+        float difference = 0.0f;
+        for (size_t i = 0; i < nodes.size(); i++)
+            difference = std::max(difference, (scene.world(nodes[i]) - updated[i]).cwiseAbs().maxCoeff());
+        std::printf("  %6zu nodes  first update %8.3f ms  full %8.3f ms  dirty %8.3f ms (%zu nodes)  speedup %5.1fx  difference %g\n",
+                    scene.size(), sort, full, dirty, recomputed / frames, full / dirty, difference);
+    }
+}
+
+// A BVH over boxes scattered around the origin: build and refit times, then frustum queries
+// against a linear SIMD cull and ray picks against testing every box. The query sets and the
+// nearest hits have to match; the rays are checked on the first few hundred.
+inline void BenchmarkBvh(JobSystem& jobs)
+{
+    constexpr int repeats = 3, views = 16, rays = 100000, checkedRays = 200;
+    std::printf("bvh: %d runs each, %u worker threads\n", repeats, jobs.threadCount());
+    for (size_t count : { (size_t)100000, (size_t)1000000 })
+    {
+        BoxBatch boxes;
+        boxes.resize(count);
+        uint32_t seed = 12345;
+        auto random = [&seed] { seed = seed * 1664525u + 1013904223u; return (float)(seed >> 8) / (1 << 24); };
+        for (size_t i = 0; i < count; i++)
+        {
+            const Eigen::Vector3f center(random() * 200.0f - 100.0f, random() * 200.0f - 100.0f, random() * 200.0f - 100.0f);
+            const Eigen::Vector3f extent(random() + 0.1f, random() + 0.1f, random() + 0.1f);
+            boxes.set(i, center - extent, center + extent);
+        }
+
+        Bvh bvh;
+        BenchmarkTimer buildTimer;
+        for (int run = 0; run < repeats; run++)
+            bvh.build(jobs, boxes);
+        const double build = buildTimer.milliseconds() / repeats;
+        // every box drifts a little, as moving objects would between frames
+        for (size_t i = 0; i < count; i++)
+        {
+            boxes.centerX[i] += random() - 0.5f;
+            boxes.centerY[i] += random() - 0.5f;
+        }
+        BenchmarkTimer refitTimer;
+        for (int run = 0; run < repeats; run++)
+            bvh.refit(jobs, boxes);
+        const double refit = refitTimer.milliseconds() / repeats;
+        std::printf("  %7zu boxes  build %8.3f ms  refit %8.3f ms  %zu nodes of %zu bytes\n",
+                    count, build, refit, bvh.size(), sizeof(BvhNode));
+
+        std::vector<Frustum> frusta;
+        for (int view = 0; view < views; view++)
+        {
+            const float angle = view * 2.0f * 3.14159265f / views;
+            frusta.push_back(ExtractFrustum(GetMatPerspectiveProjection(0.8f, 1.5f, 0.1f, 100.0f) *
+                                            GetLookAtMat(Eigen::Vector3f(0, 0, 0), Eigen::Vector3f(std::sin(angle), 0, -std::cos(angle)),
+                                                         Eigen::Vector3f(0, 1, 0))));
+        }
+        std::vector<uint32_t> linear(count), found;
+        bool same = true;
+        size_t visible = 0;
+        BenchmarkTimer linearTimer;
+        for (const Frustum& frustum : frusta)
+            visible += CullRange(frustum, boxes, 0, count, linear.data());
+        const double linearQuery = linearTimer.milliseconds() / views;
+        BenchmarkTimer queryTimer;
+        for (const Frustum& frustum : frusta)
+        {
+            found.clear();
+            bvh.query(frustum, found);
+        }
+        const double query = queryTimer.milliseconds() / views;
+        for (const Frustum& frustum : frusta)
+        {
+            found.clear();
+            bvh.query(frustum, found);
+            std::sort(found.begin(), found.end());
+            linear.resize(CullRange(frustum, boxes, 0, count, linear.data()));
+            same = same && found == linear;
+            linear.resize(count);
+        }
+        std::printf("  frustum  linear %8.3f ms  bvh %8.3f ms  speedup %5.1fx  %zu visible  %s\n",
+                    linearQuery, query, linearQuery / query, visible / views, same ? "identical" : "DIFFERENT");
+
+        std::vector<Eigen::Vector3f> origins(rays), directions(rays);
+        for (int ray = 0; ray < rays; ray++)
+        {
+            origins[ray] = Eigen::Vector3f(random() * 20.0f - 10.0f, random() * 20.0f - 10.0f, random() * 20.0f - 10.0f);
+            directions[ray] = Eigen::Vector3f(random() * 2.0f - 1.0f, random() * 2.0f - 1.0f, random() * 2.0f - 1.0f).normalized();
+        }
+        std::vector<BvhHit> hits(rays);
+        BenchmarkTimer rayTimer;
+        for (int ray = 0; ray < rays; ray++)
+            hits[ray] = bvh.raycast(origins[ray], directions[ray], boxes);
+        const double rayMilliseconds = rayTimer.milliseconds();
+        size_t hitCount = 0;
+        for (const BvhHit& hit : hits)
+            hitCount += hit.hit();
+        bool hitsSame = true;
+        BenchmarkTimer bruteTimer;
+        for (int ray = 0; ray < checkedRays; ray++)
+        {
+            const Eigen::Vector3f inverse = directions[ray].cwiseInverse();
+            BvhHit nearest;
+            for (uint32_t i = 0; i < count; i++)
+            {
+                const float minimum[3] = { boxes.centerX[i] - boxes.extentX[i], boxes.centerY[i] - boxes.extentY[i], boxes.centerZ[i] - boxes.extentZ[i] };
+                const float maximum[3] = { boxes.centerX[i] + boxes.extentX[i], boxes.centerY[i] + boxes.extentY[i], boxes.centerZ[i] + boxes.extentZ[i] };
+                const float distance = IntersectRayBox(origins[ray], inverse, minimum, maximum, nearest.distance);
+                if (distance < nearest.distance)
+                {
+                    nearest.index = i;
+                    nearest.distance = distance;
+                }
+            }
+            hitsSame = hitsSame && nearest.index == hits[ray].index;
+        }
+        const double brute = bruteTimer.milliseconds() / checkedRays;
+        std::printf("  rays     linear %8.3f ms  bvh %8.5f ms per ray  %6.2f Mrays/s  %zu of %d hit  %s\n",
+                    brute, rayMilliseconds / rays, rays / rayMilliseconds / 1000.0, hitCount, rays, hitsSame ? "identical" : "DIFFERENT");
+    }
+}
+
+#endif
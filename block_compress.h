@@ -0,0 +1,465 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// S3TC encoder: BC1 (DXT1) for opaque images, BC3 (DXT5) when there is alpha. Each 4x4 block
+// gets endpoints from the principal axis of its colors, a least squares refit and a small
+// local search over the 565 endpoint values. Every candidate is scored by fitting all 16 texels
+// to its 4 color palette, which is the hot loop and runs 4 (SSE2) or 8 (AVX2) texels at a time.
+// No GL, no shared state: call it from any thread.
+
+enum class BlockFormat
+{
+    BC1, // 8 bytes per block, RGB
+    BC3  // 16 bytes per block, BC1 style color plus interpolated alpha
+};
+
+inline size_t BlockBytes(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+inline size_t CompressedImageSize(BlockFormat format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BlockBytes(format);
+}
+
+class BlockCompressor
+{
+public:
+    // vectorized = false scores candidates with the plain C++ loop, the reference for the SIMD one
+    explicit BlockCompressor(bool vectorized = true) : vectorized(vectorized)
+    {
+#if defined(SIMD_AVX2)
+        avx2 = vectorized && SimdHasAvx2();
+#endif
+    }
+
+    // a tightly packed 8 bit image with 1 to 4 channels. 1 and 2 channel images are gray,
+    // the last channel of 2 and 4 channel images is alpha. Edge blocks repeat the last texel.
+    std::vector<unsigned char> compress(const unsigned char* pixels, int width, int height, int channels,
+                                        BlockFormat format) const
+    {
+        std::vector<unsigned char> blocks(CompressedImageSize(format, width, height));
+        unsigned char* out = blocks.data();
+        unsigned char texels[16][4];
+        for (int by = 0; by < height; by += 4)
+        {
+            for (int bx = 0; bx < width; bx += 4)
+            {
+                for (int i = 0; i < 16; i++)
+                {
+                    const int x = std::min(bx + (i & 3), width - 1), y = std::min(by + (i >> 2), height - 1);
+                    const unsigned char* texel = pixels + ((size_t)y * width + x) * channels;
+                    const bool gray = channels < 3;
+                    texels[i][0] = texel[0];
+                    texels[i][1] = gray ? texel[0] : texel[1];
+                    texels[i][2] = gray ? texel[0] : texel[2];
+                    texels[i][3] = channels == 2 || channels == 4 ? texel[channels - 1] : 255;
+                }
+                if (format == BlockFormat::BC3)
+                {
+                    CompressAlphaBlock(texels, out);
+                    out += 8;
+                }
+                compressColorBlock(texels, out);
+                out += 8;
+            }
+        }
+        return blocks;
+    }
+
+    // one 4x4 block, texels in row order
+    void compressColorBlock(const unsigned char texels[16][4], unsigned char out[8]) const
+    {
+        Block block;
+        for (int i = 0; i < 16; i++)
+        {
+            block.r[i] = texels[i][0];
+            block.g[i] = texels[i][1];
+            block.b[i] = texels[i][2];
+        }
+
+        uint16_t endpoints[2];
+        PrincipalAxisEndpoints(block, endpoints);
+        unsigned char indices[16];
+        float error = fit(block, endpoints, indices);
+
+        // refit the endpoints to the current assignment while that keeps improving things
+        for (int pass = 0; pass < 2; pass++)
+        {
+            uint16_t refit[2];
+            if (!LeastSquaresEndpoints(block, indices, refit))
+                break;
+            unsigned char refitIndices[16];
+            const float refitError = fit(block, refit, refitIndices);
+            if (refitError >= error)
+                break;
+            error = refitError;
+            endpoints[0] = refit[0];
+            endpoints[1] = refit[1];
+            memcpy(indices, refitIndices, sizeof(indices));
+        }
+
+        // nudge each of the six 565 components one step either way
+        for (int pass = 0; pass < 4 && error > 0.0f; pass++)
+        {
+            bool improved = false;
+            for (int candidate = 0; candidate < 12; candidate++)
+            {
+                uint16_t trial[2] = { endpoints[0], endpoints[1] };
+                if (!StepComponent(trial[candidate / 6], (candidate / 2) % 3, candidate & 1 ? 1 : -1))
+                    continue;
+                unsigned char trialIndices[16];
+                const float trialError = fit(block, trial, trialIndices);
+                if (trialError < error)
+                {
+                    error = trialError;
+                    endpoints[0] = trial[0];
+                    endpoints[1] = trial[1];
+                    memcpy(indices, trialIndices, sizeof(indices));
+                    improved = true;
+                }
+            }
+            if (!improved)
+                break;
+        }
+        WriteColorBlock(endpoints, indices, out);
+    }
+
+    // the 8 byte alpha half of a BC3 block: the block's min and max with 6 steps between
+    static void CompressAlphaBlock(const unsigned char texels[16][4], unsigned char out[8])
+    {
+        int low = 255, high = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            low = std::min<int>(low, texels[i][3]);
+            high = std::max<int>(high, texels[i][3]);
+        }
+        out[0] = (unsigned char)high;
+        out[1] = (unsigned char)low;
+        uint64_t bits = 0;
+        if (high > low)
+        {
+            int palette[8] = { high, low };
+            for (int i = 2; i < 8; i++)
+                palette[i] = ((8 - i) * high + (i - 1) * low) / 7;
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestError = 256;
+                for (int j = 0; j < 8; j++)
+                {
+                    const int error = std::abs(palette[j] - texels[i][3]);
+                    if (error < bestError)
+                    {
+                        best = j;
+                        bestError = error;
+                    }
+                }
+                bits |= (uint64_t)best << (3 * i);
+            }
+        }
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (unsigned char)(bits >> (8 * i));
+    }
+
+    // back to RGBA, for measuring the error of the encoder
+    static void DecompressColorBlock(const unsigned char in[8], unsigned char texels[16][4])
+    {
+        const uint16_t endpoints[2] = { (uint16_t)(in[0] | in[1] << 8), (uint16_t)(in[2] | in[3] << 8) };
+        float palette[4][3];
+        Palette(endpoints, palette);
+        for (int i = 0; i < 16; i++)
+        {
+            const int index = (in[4 + i / 4] >> (2 * (i & 3))) & 3;
+            for (int c = 0; c < 3; c++)
+                texels[i][c] = (unsigned char)(palette[index][c] + 0.5f);
+            texels[i][3] = 255;
+        }
+    }
+
+    static void DecompressAlphaBlock(const unsigned char in[8], unsigned char texels[16][4])
+    {
+        const int high = in[0], low = in[1];
+        int palette[8] = { high, low };
+        for (int i = 2; i < 8; i++)
+            palette[i] = high > low ? ((8 - i) * high + (i - 1) * low) / 7 : (i < 6 ? ((6 - i) * high + (i - 1) * low) / 5 : (i == 6 ? 0 : 255));
+        uint64_t bits = 0;
+        for (int i = 0; i < 6; i++)
+            bits |= (uint64_t)in[2 + i] << (8 * i);
+        for (int i = 0; i < 16; i++)
+            texels[i][3] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+    }
+
+private:
+    // one block as structure of arrays, so a register holds the same channel of 4 or 8 texels
+    struct Block
+    {
+        alignas(32) float r[16];
+        alignas(32) float g[16];
+        alignas(32) float b[16];
+    };
+
+    bool vectorized;
+    bool avx2 = false; // vectorized and the CPU runs AVX2
+
+    static uint16_t Pack565(float r, float g, float b)
+    {
+        const int r5 = (int)(std::min(std::max(r, 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        const int g6 = (int)(std::min(std::max(g, 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+        const int b5 = (int)(std::min(std::max(b, 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+        return (uint16_t)(r5 << 11 | g6 << 5 | b5);
+    }
+
+    static void Unpack565(uint16_t color, float rgb[3])
+    {
+        const int r5 = color >> 11, g6 = (color >> 5) & 63, b5 = color & 31;
+        rgb[0] = (float)(r5 << 3 | r5 >> 2);
+        rgb[1] = (float)(g6 << 2 | g6 >> 4);
+        rgb[2] = (float)(b5 << 3 | b5 >> 2);
+    }
+
+    // The four colors of a block in four color mode, in index order, rounded to whole values
+    // like the decoder rounds them. With whole texels too every error fit() adds up is exact,
+    // so no summing order or FMA contraction can make two paths disagree.
+    static void Palette(const uint16_t endpoints[2], float palette[4][3])
+    {
+        Unpack565(endpoints[0], palette[0]);
+        Unpack565(endpoints[1], palette[1]);
+        for (int c = 0; c < 3; c++)
+        {
+            const int first = (int)palette[0][c], second = (int)palette[1][c];
+            palette[2][c] = (float)((2 * first + second + 1) / 3);
+            palette[3][c] = (float)((first + 2 * second + 1) / 3);
+        }
+    }
+
+    // component 0 red, 1 green, 2 blue; false if the step leaves the range
+    static bool StepComponent(uint16_t& color, int component, int step)
+    {
+        const int shift = component == 0 ? 11 : component == 1 ? 5 : 0;
+        const int maximum = component == 1 ? 63 : 31;
+        const int value = ((color >> shift) & maximum) + step;
+        if (value < 0 || value > maximum)
+            return false;
+        color = (uint16_t)((color & ~(maximum << shift)) | value << shift);
+        return true;
+    }
+
+    // endpoints at the extremes of the colors projected on their principal axis
+    static void PrincipalAxisEndpoints(const Block& block, uint16_t endpoints[2])
+    {
+        float mean[3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            mean[0] += block.r[i];
+            mean[1] += block.g[i];
+            mean[2] += block.b[i];
+        }
+        for (float& m : mean)
+            m /= 16.0f;
+        float covariance[6] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            const float r = block.r[i] - mean[0], g = block.g[i] - mean[1], b = block.b[i] - mean[2];
+            covariance[0] += r * r;
+            covariance[1] += r * g;
+            covariance[2] += r * b;
+            covariance[3] += g * g;
+            covariance[4] += g * b;
+            covariance[5] += b * b;
+        }
+        // power iteration from the diagonal of the bounding box
+        float axis[3] = { 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; iteration++)
+        {
+            const float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+            const float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+            const float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+            const float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+            if (length < 1e-6f)
+                break;
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+        const float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float low = 0.0f, high = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            const float t = (block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] + (block.b[i] - mean[2]) * axis[2];
+            low = std::min(low, t);
+            high = std::max(high, t);
+        }
+        low /= lengthSquared;
+        high /= lengthSquared;
+        endpoints[0] = Pack565(mean[0] + axis[0] * high, mean[1] + axis[1] * high, mean[2] + axis[2] * high);
+        endpoints[1] = Pack565(mean[0] + axis[0] * low, mean[1] + axis[1] * low, mean[2] + axis[2] * low);
+    }
+
+    // the endpoints that minimize the squared error for a fixed assignment of indices
+    static bool LeastSquaresEndpoints(const Block& block, const unsigned char indices[16], uint16_t endpoints[2])
+    {
+        static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+        float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+        float ax[3] = {}, bx[3] = {};
+        for (int i = 0; i < 16; i++)
+        {
+            const float a = weights[indices[i]], b = 1.0f - a;
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            const float texel[3] = { block.r[i], block.g[i], block.b[i] };
+            for (int c = 0; c < 3; c++)
+            {
+                ax[c] += a * texel[c];
+                bx[c] += b * texel[c];
+            }
+        }
+        const float determinant = aa * bb - ab * ab;
+        if (std::fabs(determinant) < 1e-6f)
+            return false;
+        float first[3], second[3];
+        for (int c = 0; c < 3; c++)
+        {
+            first[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+            second[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+        }
+        endpoints[0] = Pack565(first[0], first[1], first[2]);
+        endpoints[1] = Pack565(second[0], second[1], second[2]);
+        return true;
+    }
+
+#if defined(SIMD_AVX2)
+    // fit() eight texels at a time, built for AVX2 whatever the compiler targets
+    SIMD_AVX2_TARGET static float fitAvx2(const Block& block, const float (&palette)[4][3], unsigned char indices[16])
+    {
+        __m256 total = _mm256_setzero_ps();
+        for (int i = 0; i < 16; i += 8)
+        {
+            const __m256 r = _mm256_load_ps(block.r + i), g = _mm256_load_ps(block.g + i), b = _mm256_load_ps(block.b + i);
+            __m256 best = _mm256_set1_ps(1e30f);
+            __m256 bestIndex = _mm256_setzero_ps();
+            for (int j = 0; j < 4; j++)
+            {
+                const __m256 dr = _mm256_sub_ps(r, _mm256_set1_ps(palette[j][0]));
+                const __m256 dg = _mm256_sub_ps(g, _mm256_set1_ps(palette[j][1]));
+                const __m256 db = _mm256_sub_ps(b, _mm256_set1_ps(palette[j][2]));
+                const __m256 error = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(dg, dg)), _mm256_mul_ps(db, db));
+                const __m256 closer = _mm256_cmp_ps(error, best, _CMP_LT_OQ);
+                best = _mm256_blendv_ps(best, error, closer);
+                bestIndex = _mm256_blendv_ps(bestIndex, _mm256_set1_ps((float)j), closer);
+            }
+            total = _mm256_add_ps(total, best);
+            alignas(32) float lanes[8];
+            _mm256_store_ps(lanes, bestIndex);
+            for (int k = 0; k < 8; k++)
+                indices[i + k] = (unsigned char)lanes[k];
+        }
+        alignas(32) float sums[8];
+        _mm256_store_ps(sums, total);
+        return ((sums[0] + sums[4]) + (sums[1] + sums[5])) + ((sums[2] + sums[6]) + (sums[3] + sums[7]));
+    }
+#endif
+
+    // nearest palette entry for every texel, returns the summed squared error. Ties go to the
+    // lower index and the errors are whole numbers, so the SIMD fits agree with the reference.
+    float fit(const Block& block, const uint16_t endpoints[2], unsigned char indices[16]) const
+    {
+        float palette[4][3];
+        Palette(endpoints, palette);
+#if defined(SIMD_AVX2)
+        if (avx2)
+            return fitAvx2(block, palette, indices);
+#endif
+#if defined(SIMD_SSE2)
+        if (vectorized)
+        {
+            __m128 total = _mm_setzero_ps();
+            for (int i = 0; i < 16; i += 4)
+            {
+                const __m128 r = _mm_load_ps(block.r + i), g = _mm_load_ps(block.g + i), b = _mm_load_ps(block.b + i);
+                __m128 best = _mm_set1_ps(1e30f);
+                __m128 bestIndex = _mm_setzero_ps();
+                for (int j = 0; j < 4; j++)
+                {
+                    const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[j][0]));
+                    const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[j][1]));
+                    const __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[j][2]));
+                    const __m128 error = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+                    const __m128 closer = _mm_cmplt_ps(error, best);
+                    best = _mm_or_ps(_mm_and_ps(closer, error), _mm_andnot_ps(closer, best));
+                    bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)j)), _mm_andnot_ps(closer, bestIndex));
+                }
+                total = _mm_add_ps(total, best);
+                alignas(16) float lanes[4];
+                _mm_store_ps(lanes, bestIndex);
+                for (int k = 0; k < 4; k++)
+                    indices[i + k] = (unsigned char)lanes[k];
+            }
+            alignas(16) float sums[4];
+            _mm_store_ps(sums, total);
+            return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+        }
+#endif
+        float sum = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float best = 1e30f;
+            for (int j = 0; j < 4; j++)
+            {
+                const float dr = block.r[i] - palette[j][0], dg = block.g[i] - palette[j][1], db = block.b[i] - palette[j][2];
+                const float error = dr * dr + dg * dg + db * db;
+                if (error < best)
+                {
+                    best = error;
+                    indices[i] = (unsigned char)j;
+                }
+            }
+            sum += best;
+        }
+        return sum;
+    }
+
+    // four color mode needs color0 > color1: swap if needed, and with equal endpoints every
+    // texel takes color0
+    static void WriteColorBlock(const uint16_t endpoints[2], const unsigned char indices[16], unsigned char out[8])
+    {
+        uint16_t first = endpoints[0], second = endpoints[1];
+        static const unsigned char swapped[4] = { 1, 0, 3, 2 };
+        const bool swap = first < second;
+        if (swap)
+            std::swap(first, second);
+        uint32_t bits = 0;
+        if (first != second)
+            for (int i = 0; i < 16; i++)
+                bits |= (uint32_t)(swap ? swapped[indices[i]] : indices[i]) << (2 * i);
+        out[0] = (unsigned char)first;
+        out[1] = (unsigned char)(first >> 8);
+        out[2] = (unsigned char)second;
+        out[3] = (unsigned char)(second >> 8);
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = (unsigned char)(bits >> (8 * i));
+    }
+};
+
+// BC3 when some texel is not fully opaque, BC1 otherwise
+inline BlockFormat ChooseBlockFormat(const unsigned char* pixels, int width, int height, int channels)
+{
+    if (channels != 2 && channels != 4)
+        return BlockFormat::BC1;
+    const size_t texels = (size_t)width * height;
+    for (size_t i = 0; i < texels; i++)
+        if (pixels[i * channels + channels - 1] != 255)
+            return BlockFormat::BC3;
+    return BlockFormat::BC1;
+}
+
+#endif
@@ -4,4 +4,4 @@ out vec4 FragColor;
 void main()
 {
    FragColor = ourColor;
-}; 
\ No newline at end of file
+}; 
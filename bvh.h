@@ -0,0 +1,592 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <Eigen/Dense>
+#include "job_system.h"
+#include "frustum_cull.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <vector>
+
+// One node, 32 bytes so the two children of a node (always allocated side by side, starting at
+// an even index) share a 64 byte cache line; the node array is allocated on a line boundary.
+struct alignas(32) BvhNode
+{
+    float minimum[3];
+    uint32_t leftFirst; // inner nodes: the left child, the right one follows. Leaves: the first primitive
+    float maximum[3];
+    uint32_t count;     // primitives in a leaf, 0 for inner nodes
+
+    bool leaf() const { return count > 0; }
+};
+static_assert(sizeof(BvhNode) == 32, "BvhNode has to stay 32 bytes");
+
+// storage on 64 byte boundaries, for arrays laid out by cache line
+template <typename T>
+struct CacheLineAllocator
+{
+    using value_type = T;
+    static constexpr std::align_val_t ALIGNMENT{ 64 };
+
+    CacheLineAllocator() = default;
+    template <typename U>
+    CacheLineAllocator(const CacheLineAllocator<U>&) {}
+
+    T* allocate(size_t count) { return static_cast<T*>(::operator new(count * sizeof(T), ALIGNMENT)); }
+    void deallocate(T* pointer, size_t) { ::operator delete(pointer, ALIGNMENT); }
+
+    template <typename U>
+    bool operator==(const CacheLineAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const CacheLineAllocator<U>&) const { return false; }
+};
+
+// the nearest box a ray hits
+struct BvhHit
+{
+    static constexpr uint32_t NO_HIT = 0xFFFFFFFFu;
+
+    uint32_t index = NO_HIT;
+    float distance = std::numeric_limits<float>::infinity(); // in multiples of the ray direction
+
+    bool hit() const { return index != NO_HIT; }
+};
+
+// Slab test: where the ray origin + t * direction enters the box, 0 when it starts inside, or
+// infinity when it misses the box or only reaches it beyond maxDistance.
+inline float IntersectRayBox(const Eigen::Vector3f& origin, const Eigen::Vector3f& inverseDirection,
+                             const float (&minimum)[3], const float (&maximum)[3], float maxDistance)
+{
+    float entry = 0.0f, exit = maxDistance;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const float t0 = (minimum[axis] - origin[axis]) * inverseDirection[axis];
+        const float t1 = (maximum[axis] - origin[axis]) * inverseDirection[axis];
+        entry = std::max(entry, std::min(t0, t1));
+        exit = std::min(exit, std::max(t0, t1));
+    }
+    return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+}
+
+// A bounding volume hierarchy over the boxes of a BoxBatch, for frustum queries and ray picking
+// without touching every object.
+//
+// build() splits with the surface area heuristic, binned: each split sorts the centroids into
+// BINS buckets per axis and tries the bucket boundaries only. The top splits bin across the
+// job system's threads, the subtrees below SUBTREE_SIZE primitives are then built one per job.
+// When the boxes move but the hierarchy is still reasonable, refit() recomputes the node bounds
+// in place at a fraction of the cost of a rebuild.
+class Bvh
+{
+public:
+    Bvh() = default;
+    Bvh(const Bvh&) = delete;
+    Bvh& operator=(const Bvh&) = delete;
+
+    void build(JobSystem& jobs, const BoxBatch& boxes)
+    {
+        const uint32_t count = (uint32_t)boxes.size();
+        nodes.clear();
+        spans.clear();
+        primitives.resize(count);
+        leafBoxes.resize(count);
+        if (count == 0)
+            return;
+
+        // at most 2n - 1 nodes, plus the unused slot 1 that puts every sibling pair on an even index
+        nodes.assign(2 * (size_t)count, BvhNode{});
+        used = 2;
+        building.resize(count);
+        const Eigen::AlignedBox3f bounds = reduceChunks(&jobs, 0, count, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; i++)
+            {
+                building[i].center = Eigen::Vector3f(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+                building[i].index = i;
+                building[i].extent = Eigen::Vector3f(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+            }
+            return buildingBounds(begin, end);
+        }, ExtendBox);
+        nodes[0].leftFirst = 0;
+        nodes[0].count = count;
+        SetBounds(nodes[0], bounds);
+
+        std::vector<Task> pending{ Task{ 0, 0 } }, subtrees;
+        while (!pending.empty())
+        {
+            const Task task = pending.back();
+            pending.pop_back();
+            if (nodes[task.node].count <= SUBTREE_SIZE)
+                subtrees.push_back(task);
+            else if (split(task, &jobs))
+                pushChildren(task, pending);
+        }
+        jobs.parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end)
+        {
+            std::vector<Task> stack;
+            for (size_t i = begin; i < end; i++)
+            {
+                stack.push_back(subtrees[i]);
+                while (!stack.empty())
+                {
+                    const Task task = stack.back();
+                    stack.pop_back();
+                    if (split(task, nullptr))
+                        pushChildren(task, stack);
+                }
+            }
+        });
+        nodes.resize(used);
+        for (uint32_t i = 0; i < count; i++)
+            primitives[i] = building[i].index;
+        std::vector<BuildBox>().swap(building);
+        gatherLeafBoxes(jobs, boxes);
+
+        // the primitives of every subtree are one run of the build order
+        spans.assign(nodes.size(), Span{});
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            if (nodes[i].leaf())
+                spans[i] = Span{ nodes[i].leftFirst, nodes[i].count };
+            else if (i != 1)
+                spans[i] = Span{ spans[nodes[i].leftFirst].first, spans[nodes[i].leftFirst].count + spans[nodes[i].leftFirst + 1].count };
+        }
+    }
+
+    // new bounds for the same boxes, the tree shape stays
+    void refit(JobSystem& jobs, const BoxBatch& boxes)
+    {
+        // the leaves in parallel, then the inner nodes bottom up: children always come after their parent
+        gatherLeafBoxes(jobs, boxes);
+        jobs.parallelFor(nodes.size(), REFIT_GRAIN, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+                if (nodes[i].leaf())
+                    SetBounds(nodes[i], primitiveBounds(leafBoxes, nodes[i].leftFirst, nodes[i].leftFirst + nodes[i].count));
+        });
+        for (size_t i = nodes.size(); i-- > 0;)
+        {
+            // slot 1 is the padding, neither leaf nor parent
+            if (nodes[i].leaf() || i == 1)
+                continue;
+            const BvhNode& left = nodes[nodes[i].leftFirst];
+            const BvhNode& right = nodes[nodes[i].leftFirst + 1];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                nodes[i].minimum[axis] = std::min(left.minimum[axis], right.minimum[axis]);
+                nodes[i].maximum[axis] = std::max(left.maximum[axis], right.maximum[axis]);
+            }
+        }
+    }
+
+    // Appends the indices of the boxes at least partly inside the frustum to out, in no
+    // particular order, the set a linear CullRange finds. Subtrees wholly inside are taken
+    // without testing their boxes. A straddling subtree of up to CULL_SPAN boxes isn't descended
+    // any further: its boxes sit side by side in the build order, so CullRange tests them in
+    // SIMD lanes, which beats a scalar test per node below that size.
+    void query(const Frustum& frustum, std::vector<uint32_t>& out) const
+    {
+        if (nodes.empty())
+            return;
+        uint32_t stack[MAX_DEPTH + 1];
+        size_t depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const uint32_t index = stack[--depth];
+            const BvhNode& node = nodes[index];
+            const Span span = spans[index];
+            float nearest, farthest;
+            Reach(frustum, 0.5f * (node.minimum[0] + node.maximum[0]), 0.5f * (node.minimum[1] + node.maximum[1]),
+                  0.5f * (node.minimum[2] + node.maximum[2]), 0.5f * (node.maximum[0] - node.minimum[0]),
+                  0.5f * (node.maximum[1] - node.minimum[1]), 0.5f * (node.maximum[2] - node.minimum[2]), nearest, farthest);
+            if (nearest < 0.0f)
+                continue;
+            if (farthest >= 0.0f)
+            {
+                out.insert(out.end(), primitives.begin() + span.first, primitives.begin() + span.first + span.count);
+                continue;
+            }
+            if (node.leaf() || span.count <= CULL_SPAN)
+            {
+                const size_t start = out.size();
+                out.resize(start + span.count);
+                const size_t kept = CullRange(frustum, leafBoxes, span.first, span.first + span.count, out.data() + start);
+                for (size_t i = start; i < start + kept; i++)
+                    out[i] = primitives[out[i]];
+                out.resize(start + kept);
+                continue;
+            }
+            stack[depth++] = node.leftFirst;
+            stack[depth++] = node.leftFirst + 1;
+        }
+    }
+
+    // the nearest box along origin + t * direction with t in [0, maxDistance], for picking
+    BvhHit raycast(const Eigen::Vector3f& origin, const Eigen::Vector3f& direction, const BoxBatch& boxes,
+                   float maxDistance = std::numeric_limits<float>::infinity()) const
+    {
+        BvhHit hit;
+        hit.distance = maxDistance;
+        if (nodes.empty())
+            return hit;
+        const Eigen::Vector3f inverse = direction.cwiseInverse();
+        uint32_t stack[MAX_DEPTH + 1];
+        float stackEntry[MAX_DEPTH + 1];
+        size_t depth = 0;
+        const float rootEntry = IntersectRayBox(origin, inverse, nodes[0].minimum, nodes[0].maximum, hit.distance);
+        if (rootEntry < std::numeric_limits<float>::infinity())
+        {
+            stack[depth] = 0;
+            stackEntry[depth++] = rootEntry;
+        }
+        while (depth > 0)
+        {
+            depth--;
+            // something nearer turned up since this node was pushed
+            if (stackEntry[depth] > hit.distance)
+                continue;
+            const BvhNode& node = nodes[stack[depth]];
+            if (node.leaf())
+            {
+                for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++)
+                {
+                    const uint32_t box = primitives[i];
+                    const float minimum[3] = { boxes.centerX[box] - boxes.extentX[box], boxes.centerY[box] - boxes.extentY[box],
+                                               boxes.centerZ[box] - boxes.extentZ[box] };
+                    const float maximum[3] = { boxes.centerX[box] + boxes.extentX[box], boxes.centerY[box] + boxes.extentY[box],
+                                               boxes.centerZ[box] + boxes.extentZ[box] };
+                    const float distance = IntersectRayBox(origin, inverse, minimum, maximum, hit.distance);
+                    if (distance == std::numeric_limits<float>::infinity())
+                        continue;
+                    // ties go to the lower index, like a linear scan would pick
+                    if (distance < hit.distance || box < hit.index)
+                    {
+                        hit.index = box;
+                        hit.distance = distance;
+                    }
+                }
+                continue;
+            }
+            // the nearer child goes on top so it is searched first
+            uint32_t near = node.leftFirst, far = node.leftFirst + 1;
+            float nearEntry = IntersectRayBox(origin, inverse, nodes[near].minimum, nodes[near].maximum, hit.distance);
+            float farEntry = IntersectRayBox(origin, inverse, nodes[far].minimum, nodes[far].maximum, hit.distance);
+            if (farEntry < nearEntry)
+            {
+                std::swap(near, far);
+                std::swap(nearEntry, farEntry);
+            }
+            if (farEntry < std::numeric_limits<float>::infinity())
+            {
+                stack[depth] = far;
+                stackEntry[depth++] = farEntry;
+            }
+            if (nearEntry < std::numeric_limits<float>::infinity())
+            {
+                stack[depth] = near;
+                stackEntry[depth++] = nearEntry;
+            }
+        }
+        return hit;
+    }
+
+    const std::vector<BvhNode, CacheLineAllocator<BvhNode>>& nodeArray() const { return nodes; }
+    // primitive i of a leaf is box primitiveOrder()[leftFirst + i]
+    const std::vector<uint32_t>& primitiveOrder() const { return primitives; }
+    size_t size() const { return nodes.size(); }
+    bool empty() const { return nodes.empty(); }
+
+private:
+    static constexpr int BINS = 16;
+    // a leaf is only kept bigger than this when the boxes can't be told apart
+    static constexpr uint32_t MAX_LEAF = 8;
+    // cost of visiting a node relative to testing one box
+    static constexpr float TRAVERSAL_COST = 1.0f;
+    // below this many primitives a subtree is built by one job, above it the binning is split
+    static constexpr uint32_t SUBTREE_SIZE = 32768;
+    static constexpr size_t BIN_GRAIN = 65536;
+    static constexpr size_t REFIT_GRAIN = 8192;
+    // the traversal stacks are fixed arrays, deeper nodes are made leaves
+    static constexpr uint32_t MAX_DEPTH = 64;
+    // straddling subtrees up to this many boxes are culled in one CullRange, see query()
+    static constexpr uint32_t CULL_SPAN = 256;
+
+    struct Task
+    {
+        uint32_t node, depth;
+    };
+
+    // a node's primitives, [first, first + count) of the build order
+    struct Span
+    {
+        uint32_t first = 0, count = 0;
+    };
+
+    // a box copied out of the BoxBatch for the build, so the splits read and reorder one
+    // contiguous array instead of gathering from six
+    struct BuildBox
+    {
+        Eigen::Vector3f center;
+        uint32_t index;
+        Eigen::Vector3f extent;
+        float padding;
+    };
+
+    struct Bins
+    {
+        Eigen::AlignedBox3f bounds[3][BINS];
+        uint32_t counts[3][BINS] = {};
+    };
+
+    std::vector<BvhNode, CacheLineAllocator<BvhNode>> nodes;
+    std::vector<Span> spans;        // by node
+    std::vector<uint32_t> primitives;
+    BoxBatch leafBoxes;             // the boxes in build order, primitive i at slot i
+    std::vector<BuildBox> building; // only during build()
+    std::atomic<uint32_t> used{ 0 };
+
+    static void SetBounds(BvhNode& node, const Eigen::AlignedBox3f& box)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            node.minimum[axis] = box.min()[axis];
+            node.maximum[axis] = box.max()[axis];
+        }
+    }
+
+    static void ExtendBox(Eigen::AlignedBox3f& into, const Eigen::AlignedBox3f& part) { into.extend(part); }
+
+    static float HalfArea(const Eigen::AlignedBox3f& box)
+    {
+        const Eigen::Vector3f size = box.sizes();
+        return size.x() * size.y() + size.y() * size.z() + size.z() * size.x();
+    }
+
+    // the smallest distance + reach and distance - reach over the planes, as in CullLaneGroups:
+    // the box is outside when the first is negative and wholly inside when the second isn't
+    static void Reach(const Frustum& frustum, float x, float y, float z, float ex, float ey, float ez, float& nearest, float& farthest)
+    {
+        nearest = farthest = std::numeric_limits<float>::infinity();
+        for (const float (&plane)[4] : frustum.planes)
+        {
+            const float distance = plane[0] * x + plane[1] * y + plane[2] * z + plane[3];
+            const float reach = std::fabs(plane[0]) * ex + std::fabs(plane[1]) * ey + std::fabs(plane[2]) * ez;
+            nearest = std::min(nearest, distance + reach);
+            farthest = std::min(farthest, distance - reach);
+        }
+    }
+
+    static Eigen::Vector3f Center(const BoxBatch& boxes, uint32_t box)
+    {
+        return Eigen::Vector3f(boxes.centerX[box], boxes.centerY[box], boxes.centerZ[box]);
+    }
+
+    static Eigen::AlignedBox3f BoxOf(const BoxBatch& boxes, uint32_t box)
+    {
+        const Eigen::Vector3f extent(boxes.extentX[box], boxes.extentY[box], boxes.extentZ[box]);
+        return Eigen::AlignedBox3f(Center(boxes, box) - extent, Center(boxes, box) + extent);
+    }
+
+    static Eigen::AlignedBox3f BoxOf(const BuildBox& box)
+    {
+        return Eigen::AlignedBox3f(box.center - box.extent, box.center + box.extent);
+    }
+
+    // primitives [begin, end) of the build order, from the boxes in build order
+    static Eigen::AlignedBox3f primitiveBounds(const BoxBatch& ordered, uint32_t begin, uint32_t end)
+    {
+        Eigen::AlignedBox3f bounds;
+        for (uint32_t i = begin; i < end; i++)
+            bounds.extend(BoxOf(ordered, i));
+        return bounds;
+    }
+
+    void gatherLeafBoxes(JobSystem& jobs, const BoxBatch& boxes)
+    {
+        jobs.parallelFor(primitives.size(), REFIT_GRAIN, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                const uint32_t box = primitives[i];
+                leafBoxes.centerX[i] = boxes.centerX[box];
+                leafBoxes.centerY[i] = boxes.centerY[box];
+                leafBoxes.centerZ[i] = boxes.centerZ[box];
+                leafBoxes.extentX[i] = boxes.extentX[box];
+                leafBoxes.extentY[i] = boxes.extentY[box];
+                leafBoxes.extentZ[i] = boxes.extentZ[box];
+            }
+        });
+    }
+
+    Eigen::AlignedBox3f buildingBounds(uint32_t begin, uint32_t end) const
+    {
+        Eigen::AlignedBox3f bounds;
+        for (uint32_t i = begin; i < end; i++)
+            bounds.extend(BoxOf(building[i]));
+        return bounds;
+    }
+
+    // function(begin, end) over [begin, end) in BIN_GRAIN chunks across the job system, the
+    // chunk results folded together with merge(into, part). Without a job system, or for a short
+    // range, in one go on this thread.
+    template <typename Function, typename Merge>
+    auto reduceChunks(JobSystem* jobs, uint32_t begin, uint32_t end, Function&& function, Merge&& merge) const
+        -> decltype(function(begin, end))
+    {
+        using Result = decltype(function(begin, end));
+        if (!jobs || end - begin <= BIN_GRAIN)
+            return function(begin, end);
+        std::vector<Result> parts((end - begin + BIN_GRAIN - 1) / BIN_GRAIN);
+        jobs->parallelFor(end - begin, BIN_GRAIN, [&](size_t first, size_t last)
+        {
+            parts[first / BIN_GRAIN] = function(begin + (uint32_t)first, begin + (uint32_t)last);
+        });
+        for (size_t i = 1; i < parts.size(); i++)
+            merge(parts[0], parts[i]);
+        return parts[0];
+    }
+
+    void pushChildren(const Task& task, std::vector<Task>& stack) const
+    {
+        stack.push_back(Task{ nodes[task.node].leftFirst, task.depth + 1 });
+        stack.push_back(Task{ nodes[task.node].leftFirst + 1, task.depth + 1 });
+    }
+
+    // Splits a leaf in two when the surface area heuristic says it pays, or when it holds more
+    // than MAX_LEAF boxes. Returns false when it stays a leaf. jobs bins in parallel, nullptr
+    // on this thread.
+    bool split(const Task& task, JobSystem* jobs)
+    {
+        BvhNode& node = nodes[task.node];
+        const uint32_t first = node.leftFirst, count = node.count;
+        if (count <= 1 || task.depth + 1 >= MAX_DEPTH)
+            return false;
+
+        const Eigen::AlignedBox3f centroids = reduceChunks(jobs, first, first + count, [&](uint32_t begin, uint32_t end)
+        {
+            Eigen::AlignedBox3f box;
+            for (uint32_t i = begin; i < end; i++)
+                box.extend(building[i].center);
+            return box;
+        }, ExtendBox);
+        const Eigen::Vector3f low = centroids.min(), extent = centroids.sizes();
+        Eigen::Vector3f scale;
+        for (int axis = 0; axis < 3; axis++)
+            scale[axis] = extent[axis] > 0.0f ? BINS / extent[axis] : 0.0f;
+        auto binOf = [&](const BuildBox& box, int axis)
+        {
+            return std::min(BINS - 1, (int)((box.center[axis] - low[axis]) * scale[axis]));
+        };
+
+        const Bins bins = reduceChunks(jobs, first, first + count, [&](uint32_t begin, uint32_t end)
+        {
+            Bins local;
+            for (uint32_t i = begin; i < end; i++)
+            {
+                const Eigen::AlignedBox3f box = BoxOf(building[i]);
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    if (scale[axis] == 0.0f)
+                        continue;
+                    const int bin = binOf(building[i], axis);
+                    local.bounds[axis][bin].extend(box);
+                    local.counts[axis][bin]++;
+                }
+            }
+            return local;
+        }, [](Bins& into, const Bins& part)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                for (int bin = 0; bin < BINS; bin++)
+                {
+                    into.bounds[axis][bin].extend(part.bounds[axis][bin]);
+                    into.counts[axis][bin] += part.counts[axis][bin];
+                }
+            }
+        });
+
+        // sweep each axis: bins up to bestBin go left. Costs are area * boxes, relative to the node's area.
+        int bestAxis = -1, bestBin = 0;
+        float bestCost = std::numeric_limits<float>::infinity();
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (scale[axis] == 0.0f)
+                continue;
+            float leftCost[BINS - 1];
+            uint32_t leftCount[BINS - 1];
+            Eigen::AlignedBox3f sweep;
+            uint32_t swept = 0;
+            for (int bin = 0; bin < BINS - 1; bin++)
+            {
+                sweep.extend(bins.bounds[axis][bin]);
+                swept += bins.counts[axis][bin];
+                leftCount[bin] = swept;
+                leftCost[bin] = swept ? HalfArea(sweep) * swept : 0.0f;
+            }
+            sweep.setEmpty();
+            swept = 0;
+            for (int bin = BINS - 1; bin > 0; bin--)
+            {
+                sweep.extend(bins.bounds[axis][bin]);
+                swept += bins.counts[axis][bin];
+                if (swept == 0 || leftCount[bin - 1] == 0)
+                    continue;
+                const float cost = leftCost[bin - 1] + HalfArea(sweep) * swept;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = bin - 1;
+                }
+            }
+        }
+
+        Eigen::AlignedBox3f leftBounds, rightBounds;
+        uint32_t leftCount = 0;
+        if (bestAxis >= 0)
+        {
+            const float area = HalfArea(Eigen::AlignedBox3f(Eigen::Vector3f(node.minimum[0], node.minimum[1], node.minimum[2]),
+                                                            Eigen::Vector3f(node.maximum[0], node.maximum[1], node.maximum[2])));
+            if (count <= MAX_LEAF && TRAVERSAL_COST * area + bestCost >= area * count)
+                return false;
+            for (int bin = 0; bin < BINS; bin++)
+            {
+                (bin <= bestBin ? leftBounds : rightBounds).extend(bins.bounds[bestAxis][bin]);
+                if (bin <= bestBin)
+                    leftCount += bins.counts[bestAxis][bin];
+            }
+            std::partition(building.begin() + first, building.begin() + first + count,
+                           [&](const BuildBox& box) { return binOf(box, bestAxis) <= bestBin; });
+        }
+        else
+        {
+            // every centroid in one spot, only the number of boxes per leaf can be helped
+            if (count <= MAX_LEAF)
+                return false;
+            leftCount = count / 2;
+            leftBounds = buildingBounds(first, first + leftCount);
+            rightBounds = buildingBounds(first + leftCount, first + count);
+        }
+
+        const uint32_t left = used.fetch_add(2);
+        nodes[left].leftFirst = first;
+        nodes[left].count = leftCount;
+        SetBounds(nodes[left], leftBounds);
+        nodes[left + 1].leftFirst = first + leftCount;
+        nodes[left + 1].count = count - leftCount;
+        SetBounds(nodes[left + 1], rightBounds);
+        node.leftFirst = left;
+        node.count = 0;
+        return true;
+    }
+};
+
+#endif
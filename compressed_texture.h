@@ -0,0 +1,210 @@
+#ifndef COMPRESSED_TEXTURE_H
+#define COMPRESSED_TEXTURE_H
+
+#include <glad/glad.h>
+#include "gl_extensions.h"
+#include "program_cache.h"
+#include "block_compress.h"
+#include "mipmap.h"
+#include "image_decode.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// GL_EXT_texture_compression_s3tc, glad was generated without extensions
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// A texture as S3TC blocks, every mip level included. Compressing costs far more than decoding,
+// so the result is cached on disk next to the program binaries, keyed by the bytes of the image
+// file and the settings: the first run pays for decode + mips + encode, later runs just read it.
+
+// where the compressed textures are written, relative to the working directory
+inline std::string textureCacheDirectory = "texture_cache";
+
+struct CompressedLevel
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> blocks;
+};
+
+struct CompressedTexture
+{
+    GLenum internalFormat = 0; // GL_COMPRESSED_*_S3TC_*_EXT, 0 if empty
+    std::vector<CompressedLevel> levels;
+
+    bool empty() const { return levels.empty(); }
+    size_t size() const
+    {
+        size_t bytes = 0;
+        for (const auto& level : levels)
+            bytes += level.blocks.size();
+        return bytes;
+    }
+};
+
+struct CompressedTextureHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t internalFormat;
+    uint32_t levelCount;
+};
+struct CompressedLevelHeader
+{
+    int32_t width;
+    int32_t height;
+    uint64_t size;
+};
+constexpr uint32_t COMPRESSED_TEXTURE_MAGIC = 0x58544342; // "BCTX"
+// bump when the encoder changes its output, so stale entries miss
+constexpr uint32_t COMPRESSED_TEXTURE_VERSION = 2;
+
+// Only call with a current context.
+inline bool BlockCompressionSupported()
+{
+    return HasGLExtension("GL_EXT_texture_compression_s3tc");
+}
+
+inline GLenum InternalFormatForBlocks(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+}
+
+// level 0 and the mip chain below it into blocks, BC3 only if some texel is see-through
+inline CompressedTexture CompressTexture(const unsigned char* pixels, int width, int height, int channels,
+                                         const std::vector<MipLevel>& mips)
+{
+    const BlockFormat format = ChooseBlockFormat(pixels, width, height, channels);
+    const BlockCompressor compressor;
+    CompressedTexture texture;
+    texture.internalFormat = InternalFormatForBlocks(format);
+    texture.levels.reserve(mips.size() + 1);
+    texture.levels.push_back(CompressedLevel{ width, height, compressor.compress(pixels, width, height, channels, format) });
+    for (const auto& mip : mips)
+    {
+        texture.levels.push_back(CompressedLevel{ mip.width, mip.height,
+                                                  compressor.compress(mip.pixels.data(), mip.width, mip.height, channels, format) });
+    }
+    return texture;
+}
+
+inline uint64_t CompressedTextureKey(const unsigned char* fileBytes, size_t size, bool flipY, const MipmapOptions& mipmaps)
+{
+    uint64_t key = HashBytes(fileBytes, size);
+    const uint32_t settings[4] = { flipY, (uint32_t)mipmaps.filter, mipmaps.srgb, COMPRESSED_TEXTURE_VERSION };
+    key = HashBytes(settings, sizeof(settings), key);
+    return HashBytes(&mipmaps.alphaCutoff, sizeof(mipmaps.alphaCutoff), key);
+}
+
+inline std::filesystem::path CompressedTexturePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bct", (unsigned long long)key);
+    return std::filesystem::path(textureCacheDirectory) / name;
+}
+
+// false on a miss or a damaged entry
+inline bool LoadCompressedTexture(uint64_t key, CompressedTexture& texture)
+{
+    std::ifstream file(CompressedTexturePath(key), std::ios::binary);
+    if (!file)
+        return false;
+    CompressedTextureHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != COMPRESSED_TEXTURE_MAGIC || header.version != COMPRESSED_TEXTURE_VERSION ||
+        header.key != key || header.levelCount == 0 || header.levelCount > 32)
+        return false;
+
+    CompressedTexture loaded;
+    loaded.internalFormat = header.internalFormat;
+    loaded.levels.resize(header.levelCount);
+    for (auto& level : loaded.levels)
+    {
+        CompressedLevelHeader levelHeader{};
+        file.read(reinterpret_cast<char*>(&levelHeader), sizeof(levelHeader));
+        if (!file || levelHeader.size > (1ull << 32))
+            return false;
+        level.width = levelHeader.width;
+        level.height = levelHeader.height;
+        level.blocks.resize((size_t)levelHeader.size);
+        file.read(reinterpret_cast<char*>(level.blocks.data()), level.blocks.size());
+        if (!file)
+            return false;
+    }
+    texture = std::move(loaded);
+    return true;
+}
+
+inline void SaveCompressedTexture(uint64_t key, const CompressedTexture& texture)
+{
+    std::error_code error;
+    std::filesystem::create_directories(textureCacheDirectory, error);
+    // write next to the final name and rename, so a crash never leaves a truncated entry behind
+    const auto path = CompressedTexturePath(key);
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::TEXTURE::CACHE::WRITE_FAILED " << temporary.string() << std::endl;
+            return;
+        }
+        const CompressedTextureHeader header{ COMPRESSED_TEXTURE_MAGIC, COMPRESSED_TEXTURE_VERSION, key,
+                                              texture.internalFormat, (uint32_t)texture.levels.size() };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& level : texture.levels)
+        {
+            const CompressedLevelHeader levelHeader{ level.width, level.height, level.blocks.size() };
+            file.write(reinterpret_cast<const char*>(&levelHeader), sizeof(levelHeader));
+            file.write(reinterpret_cast<const char*>(level.blocks.data()), level.blocks.size());
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+}
+
+// The compressed texture for an image file, from the cache or decoded, mipmapped, compressed
+// and cached. Any thread. False if the file can't be read or decoded.
+inline bool LoadOrCompressTexture(const std::vector<unsigned char>& fileBytes, bool flipY, const MipmapOptions& mipmaps,
+                                  CompressedTexture& texture)
+{
+    const uint64_t key = CompressedTextureKey(fileBytes.data(), fileBytes.size(), flipY, mipmaps);
+    if (LoadCompressedTexture(key, texture))
+        return true;
+
+    ImageDecodeOptions options;
+    options.flipVertically = flipY;
+    int width, height, channels;
+    unsigned char* pixels = DecodeImage(fileBytes.data(), fileBytes.size(), options, &width, &height, &channels);
+    if (!pixels)
+        return false;
+    texture = CompressTexture(pixels, width, height, channels, BuildMipChain(pixels, width, height, channels, mipmaps));
+    stbi_image_free(pixels);
+    SaveCompressedTexture(key, texture);
+    return true;
+}
+
+// every level into the texture bound for update
+inline void UploadCompressedTexture(GLenum target, const CompressedTexture& texture)
+{
+    for (size_t i = 0; i < texture.levels.size(); i++)
+    {
+        const CompressedLevel& level = texture.levels[i];
+        glCompressedTexImage2D(target, (GLint)i, texture.internalFormat, level.width, level.height, 0,
+                               (GLsizei)level.blocks.size(), level.blocks.data());
+    }
+}
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Bump allocator for data that lives exactly one frame. Allocations are never freed one by one,
+// reset() rewinds the whole arena and keeps its memory for the next frame. Memory comes in
+// fixed size blocks so earlier allocations never move when the arena grows.
+class FrameArena
+{
+public:
+    explicit FrameArena(size_t blockSize = 1 << 20)
+        : blockSize(blockSize)
+    {
+    }
+
+    void* allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+        while (true)
+        {
+            if (current < blocks.size())
+            {
+                const uintptr_t base = reinterpret_cast<uintptr_t>(blocks[current].memory.get());
+                const uintptr_t aligned = (base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+                if (aligned + size <= base + blocks[current].size)
+                {
+                    offset = aligned + size - base;
+                    used += size;
+                    return reinterpret_cast<void*>(aligned);
+                }
+                // the rest of this block is wasted until the next reset
+                current++;
+                offset = 0;
+                continue;
+            }
+            // out of blocks, oversized requests get a block of their own
+            const size_t newSize = size + alignment > blockSize ? size + alignment : blockSize;
+            blocks.push_back(Block{ std::unique_ptr<char[]>(new char[newSize]), newSize });
+            current = blocks.size() - 1;
+            offset = 0;
+        }
+    }
+
+    // typed allocation for trivially copyable data, the arena never runs destructors
+    template <typename T>
+    T* allocate(size_t count = 1)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "frame arena memory is never destroyed");
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void reset()
+    {
+        current = 0;
+        offset = 0;
+        used = 0;
+    }
+
+    size_t bytesUsed() const { return used; }
+    size_t bytesReserved() const
+    {
+        size_t total = 0;
+        for (const auto& block : blocks)
+            total += block.size;
+        return total;
+    }
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t blockSize;
+    size_t current = 0;
+    size_t offset = 0;
+    size_t used = 0;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef FRAME_CONSTANTS_H
+#define FRAME_CONSTANTS_H
+
+#include <glad/glad.h>
+#include <Eigen/Dense>
+#include "gl_state.h"
+
+#include <cstring>
+
+// Per frame values every program shares, uploaded once per frame into a uniform buffer bound at
+// FRAME_CONSTANTS_BINDING. A shader stage that reads them puts the line
+//
+//   #pragma frame_constants
+//
+// where the block belongs, Shader swaps in FRAME_CONSTANTS_GLSL when it loads the source, so
+// the block is written down only here. Shader also points the block at the binding after
+// linking, GLSL 3.30 has no binding layout.
+constexpr GLuint FRAME_CONSTANTS_BINDING = 0;
+constexpr const char* FRAME_CONSTANTS_BLOCK = "FrameConstants";
+constexpr const char* FRAME_CONSTANTS_PRAGMA = "#pragma frame_constants";
+
+// the GLSL side of the struct below, keep the two in step
+constexpr const char* FRAME_CONSTANTS_GLSL =
+    "layout (std140) uniform FrameConstants\n"
+    "{\n"
+    "    mat4 view;\n"
+    "    mat4 projection;\n"
+    "    mat4 viewProj;\n"
+    "    vec4 cameraPos;\n"
+    "    float time;\n"
+    "    float deltaTime;\n"
+    "};\n";
+
+// std140 layout of the block above
+struct FrameConstants
+{
+    float view[16];
+    float projection[16];
+    float viewProj[16];
+    float cameraPos[4];
+    float time;
+    float deltaTime;
+    float padding[2];
+};
+static_assert(sizeof(FrameConstants) == 224, "FrameConstants must match the std140 block");
+
+class FrameConstantsBuffer
+{
+public:
+    FrameConstantsBuffer()
+    {
+        glGenBuffers(1, &id);
+        glState.bindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), nullptr, GL_DYNAMIC_DRAW);
+        glState.bindBufferBase(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, id);
+    }
+
+    void update(const Eigen::Matrix4f& view, const Eigen::Matrix4f& projection, const Eigen::Vector3f& cameraPos,
+                float time, float deltaTime)
+    {
+        const Eigen::Matrix4f viewProj = projection * view;
+        memcpy(constants.view, view.data(), sizeof(constants.view));
+        memcpy(constants.projection, projection.data(), sizeof(constants.projection));
+        memcpy(constants.viewProj, viewProj.data(), sizeof(constants.viewProj));
+        constants.cameraPos[0] = cameraPos.x();
+        constants.cameraPos[1] = cameraPos.y();
+        constants.cameraPos[2] = cameraPos.z();
+        constants.cameraPos[3] = 1.0f;
+        constants.time = time;
+        constants.deltaTime = deltaTime;
+
+        glState.bindBuffer(GL_UNIFORM_BUFFER, id);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameConstants), &constants);
+    }
+
+    const FrameConstants& current() const { return constants; }
+    GLuint buffer() const { return id; }
+
+private:
+    GLuint id = 0;
+    FrameConstants constants{};
+};
+
+#endif
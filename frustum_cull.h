@@ -0,0 +1,285 @@
+#ifndef FRUSTUM_CULL_H
+#define FRUSTUM_CULL_H
+
+#include <Eigen/Dense>
+#include "job_system.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// The six planes of a view frustum, each (nx, ny, nz, d) with a unit normal pointing inwards,
+// so a point p is inside a plane when n.p + d >= 0.
+struct Frustum
+{
+    float planes[6][4]; // left, right, bottom, top, then the two depth planes
+};
+
+// Gribb/Hartmann: the planes come straight out of the rows of projection * view (the product
+// of GetMatPerspectiveProjection and GetLookAtMat), in world space. zeroToOneDepth is for clip
+// depth running 0..w (glClipControl GL_ZERO_TO_ONE, see SceneDepth) instead of -w..w. A plane
+// whose normal comes out zero, like the far plane of an infinite projection, is made one that
+// keeps everything.
+inline Frustum ExtractFrustum(const Eigen::Matrix4f& viewProjection, bool zeroToOneDepth = false)
+{
+    const Eigen::Vector4f x = viewProjection.row(0).transpose(), y = viewProjection.row(1).transpose();
+    const Eigen::Vector4f z = viewProjection.row(2).transpose(), w = viewProjection.row(3).transpose();
+    const Eigen::Vector4f planes[6] = { w + x, w - x, w + y, w - y, zeroToOneDepth ? z : Eigen::Vector4f(w + z), w - z };
+    Frustum frustum;
+    for (int i = 0; i < 6; i++)
+    {
+        const float length = planes[i].head<3>().norm();
+        const Eigen::Vector4f plane = length > 1e-6f ? Eigen::Vector4f(planes[i] / length) : Eigen::Vector4f(0, 0, 0, 1);
+        for (int c = 0; c < 4; c++)
+            frustum.planes[i][c] = plane[c];
+    }
+    return frustum;
+}
+
+// bounding spheres, one array per component
+struct SphereBatch
+{
+    std::vector<float> centerX, centerY, centerZ, radius;
+
+    size_t size() const { return centerX.size(); }
+    void resize(size_t count)
+    {
+        centerX.resize(count); centerY.resize(count); centerZ.resize(count); radius.resize(count);
+    }
+    void set(size_t i, const Eigen::Vector3f& center, float r)
+    {
+        centerX[i] = center.x(); centerY[i] = center.y(); centerZ[i] = center.z(); radius[i] = r;
+    }
+};
+
+// world space AABBs as center and half extents, one array per component
+struct BoxBatch
+{
+    std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+
+    size_t size() const { return centerX.size(); }
+    void resize(size_t count)
+    {
+        centerX.resize(count); centerY.resize(count); centerZ.resize(count);
+        extentX.resize(count); extentY.resize(count); extentZ.resize(count);
+    }
+    void set(size_t i, const Eigen::Vector3f& minimum, const Eigen::Vector3f& maximum)
+    {
+        const Eigen::Vector3f center = (minimum + maximum) * 0.5f, extent = (maximum - minimum) * 0.5f;
+        centerX[i] = center.x(); centerY[i] = center.y(); centerZ[i] = center.z();
+        extentX[i] = extent.x(); extentY[i] = extent.y(); extentZ[i] = extent.z();
+    }
+};
+
+// The arithmetic of one lane group of bounds, see CullLaneGroups.
+struct ScalarCullLanes
+{
+    using Value = float;
+    static constexpr size_t WIDTH = 1;
+    static Value load(const float* p) { return *p; }
+    static Value broadcast(float v) { return v; }
+    static Value add(Value a, Value b) { return a + b; }
+    static Value mul(Value a, Value b) { return a * b; }
+    static Value min(Value a, Value b) { return a < b ? a : b; }
+    // bit i set when lane i is >= 0
+    static unsigned nonNegative(Value a) { return a >= 0.0f ? 1u : 0u; }
+};
+
+#if defined(SIMD_SSE2)
+struct SseCullLanes
+{
+    using Value = __m128;
+    static constexpr size_t WIDTH = 4;
+    static Value load(const float* p) { return _mm_loadu_ps(p); }
+    static Value broadcast(float v) { return _mm_set1_ps(v); }
+    static Value add(Value a, Value b) { return _mm_add_ps(a, b); }
+    static Value mul(Value a, Value b) { return _mm_mul_ps(a, b); }
+    static Value min(Value a, Value b) { return _mm_min_ps(a, b); }
+    static unsigned nonNegative(Value a) { return (unsigned)_mm_movemask_ps(_mm_cmpge_ps(a, _mm_setzero_ps())); }
+};
+#endif
+
+#if defined(SIMD_AVX2)
+struct AvxCullLanes
+{
+    using Value = __m256;
+    static constexpr size_t WIDTH = 8;
+    SIMD_AVX2_TARGET static Value load(const float* p) { return _mm256_loadu_ps(p); }
+    SIMD_AVX2_TARGET static Value broadcast(float v) { return _mm256_set1_ps(v); }
+    SIMD_AVX2_TARGET static Value add(Value a, Value b) { return _mm256_add_ps(a, b); }
+    SIMD_AVX2_TARGET static Value mul(Value a, Value b) { return _mm256_mul_ps(a, b); }
+    SIMD_AVX2_TARGET static Value min(Value a, Value b) { return _mm256_min_ps(a, b); }
+    SIMD_AVX2_TARGET static unsigned nonNegative(Value a) { return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GE_OQ)); }
+};
+#endif
+
+// An object is outside when it lies wholly behind one plane: the signed distance of its center
+// is less than -r, with r the radius, or for a box its extents projected onto the plane normal.
+// The smallest distance + r over the planes decides. Appends the visible indices from begin on
+// to out, a whole lane group at a time, and returns where it stopped; the caller finishes the
+// rest with narrower lanes.
+SIMD_LANES_BEGIN
+template <typename Lanes, typename Batch>
+size_t CullLaneGroups(const Frustum& frustum, const Batch& bounds, size_t begin, size_t end, uint32_t* out, size_t& kept)
+{
+    using V = typename Lanes::Value;
+    constexpr bool boxes = std::is_same<Batch, BoxBatch>::value;
+    V normal[6][4], magnitude[6][3];
+    for (int p = 0; p < 6; p++)
+    {
+        for (int c = 0; c < 4; c++)
+            normal[p][c] = Lanes::broadcast(frustum.planes[p][c]);
+        for (int c = 0; c < 3; c++)
+            magnitude[p][c] = Lanes::broadcast(std::fabs(frustum.planes[p][c]));
+    }
+
+    size_t i = begin;
+    for (; i + Lanes::WIDTH <= end; i += Lanes::WIDTH)
+    {
+        const V x = Lanes::load(&bounds.centerX[i]), y = Lanes::load(&bounds.centerY[i]), z = Lanes::load(&bounds.centerZ[i]);
+        V ex, ey, ez, radius;
+        if constexpr (boxes)
+        {
+            ex = Lanes::load(&bounds.extentX[i]);
+            ey = Lanes::load(&bounds.extentY[i]);
+            ez = Lanes::load(&bounds.extentZ[i]);
+        }
+        else
+        {
+            radius = Lanes::load(&bounds.radius[i]);
+        }
+        // written out rather than as a lambda, which would return an AVX value out of line
+        V nearest = Lanes::broadcast(0.0f);
+        for (int p = 0; p < 6; p++)
+        {
+            const V distance = Lanes::add(Lanes::add(Lanes::add(Lanes::mul(normal[p][0], x), Lanes::mul(normal[p][1], y)),
+                                                     Lanes::mul(normal[p][2], z)), normal[p][3]);
+            if constexpr (boxes)
+                radius = Lanes::add(Lanes::add(Lanes::mul(magnitude[p][0], ex), Lanes::mul(magnitude[p][1], ey)),
+                                    Lanes::mul(magnitude[p][2], ez));
+            const V reach = Lanes::add(distance, radius);
+            nearest = p == 0 ? reach : Lanes::min(nearest, reach);
+        }
+        for (unsigned mask = Lanes::nonNegative(nearest); mask != 0; mask &= mask - 1)
+        {
+            unsigned lane = 0;
+            while (!(mask & (1u << lane)))
+                lane++;
+            out[kept++] = (uint32_t)(i + lane);
+        }
+    }
+    return i;
+}
+SIMD_LANES_END
+
+#if defined(SIMD_AVX2)
+template <typename Batch>
+SIMD_AVX2_KERNEL size_t CullLaneGroupsAvx2(const Frustum& frustum, const Batch& bounds, size_t begin, size_t end, uint32_t* out, size_t& kept)
+{
+    return CullLaneGroups<AvxCullLanes>(frustum, bounds, begin, end, out, kept);
+}
+#endif
+
+// the visible objects of [begin, end) on the calling thread, their indices written to out in
+// order. Returns how many. vectorized = false tests one object at a time, the reference for
+// the SIMD lanes.
+template <typename Batch>
+size_t CullRange(const Frustum& frustum, const Batch& bounds, size_t begin, size_t end, uint32_t* out, bool vectorized = true)
+{
+    size_t kept = 0;
+    size_t i = begin;
+#if defined(SIMD_AVX2)
+    if (vectorized && SimdHasAvx2())
+        i = CullLaneGroupsAvx2(frustum, bounds, i, end, out, kept);
+#endif
+#if defined(SIMD_SSE2)
+    if (vectorized)
+        i = CullLaneGroups<SseCullLanes>(frustum, bounds, i, end, out, kept);
+#endif
+    CullLaneGroups<ScalarCullLanes>(frustum, bounds, i, end, out, kept);
+    return kept;
+}
+
+// visible and culled objects, per frame or summed up
+struct CullStats
+{
+    size_t visible = 0;
+    size_t culled = 0;
+};
+
+// Culls spheres or boxes against a frustum and hands back the indices of the visible ones, in
+// order. Bounds go through in SIMD lane groups (8 per AVX2 iteration, 4 with SSE2), large
+// batches split across the job system's threads.
+class FrustumCuller
+{
+public:
+    // vectorized as for CullRange
+    explicit FrustumCuller(JobSystem& jobs, bool vectorized = true)
+        : jobs(jobs), vectorized(vectorized)
+    {
+    }
+
+    FrustumCuller(const FrustumCuller&) = delete;
+    FrustumCuller& operator=(const FrustumCuller&) = delete;
+
+    // indices of the objects at least partly inside, valid until the next cull
+    const std::vector<uint32_t>& cull(const Frustum& frustum, const SphereBatch& bounds) { return run(frustum, bounds); }
+    const std::vector<uint32_t>& cull(const Frustum& frustum, const BoxBatch& bounds) { return run(frustum, bounds); }
+
+    // call once per frame, after the frame's culls
+    void endFrame()
+    {
+        previous = current;
+        total.visible += current.visible;
+        total.culled += current.culled;
+        current = CullStats{};
+        frames++;
+    }
+
+    const CullStats& lastFrame() const { return previous; }
+    const CullStats& totals() const { return total; }
+    size_t frameCount() const { return frames; }
+
+private:
+    // per chunk of objects, so a chunk outweighs handing it to a worker; a multiple of every
+    // lane width
+    static constexpr size_t GRAIN = 16384;
+
+    JobSystem& jobs;
+    bool vectorized;
+    std::vector<uint32_t> visible;
+    std::vector<size_t> chunkCounts;
+    CullStats current, previous, total;
+    size_t frames = 0;
+
+    template <typename Batch>
+    const std::vector<uint32_t>& run(const Frustum& frustum, const Batch& bounds)
+    {
+        const size_t count = bounds.size();
+        // each chunk compacts into its own stretch of visible, then the stretches are closed up
+        visible.resize(count);
+        chunkCounts.assign((count + GRAIN - 1) / GRAIN, 0);
+        jobs.parallelFor(count, GRAIN, [&](size_t begin, size_t end)
+        {
+            chunkCounts[begin / GRAIN] = CullRange(frustum, bounds, begin, end, visible.data() + begin, vectorized);
+        });
+        size_t kept = 0;
+        for (size_t chunk = 0; chunk < chunkCounts.size(); chunk++)
+        {
+            if (kept != chunk * GRAIN)
+                memmove(visible.data() + kept, visible.data() + chunk * GRAIN, chunkCounts[chunk] * sizeof(uint32_t));
+            kept += chunkCounts[chunk];
+        }
+        visible.resize(kept);
+        current.visible += kept;
+        current.culled += count - kept;
+        return visible;
+    }
+};
+
+#endif
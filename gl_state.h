@@ -0,0 +1,252 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Shadow copy of the bits of GL state we touch every frame. Every bind goes through here and
+// is dropped when the driver already has that state, with a count of how many calls were saved.
+// GL thread only, and anything that binds behind its back has to call invalidate().
+class GLStateCache
+{
+public:
+    static constexpr int MAX_TEXTURE_UNITS = 32;
+
+    struct Stats
+    {
+        uint32_t issued = 0;
+        uint32_t elided = 0;
+    };
+
+    GLStateCache()
+    {
+        invalidate();
+    }
+
+    // forget everything, the next call of each kind always reaches the driver
+    void invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (auto& unit : textures)
+            for (auto& texture : unit)
+                texture = UNKNOWN;
+        for (auto& buffer : buffers)
+            buffer = UNKNOWN;
+        capabilities.clear();
+    }
+
+    void useProgram(GLuint id)
+    {
+        if (program == id)
+        {
+            frame.elided++;
+            return;
+        }
+        program = id;
+        frame.issued++;
+        glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (vertexArray == id)
+        {
+            frame.elided++;
+            return;
+        }
+        vertexArray = id;
+        // the element buffer binding belongs to the VAO, so we no longer know it
+        buffers[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+        frame.issued++;
+        glBindVertexArray(id);
+    }
+
+    void bindBuffer(GLenum target, GLuint id)
+    {
+        const int slot = bufferSlot(target);
+        if (slot < 0)
+        {
+            frame.issued++;
+            glBindBuffer(target, id);
+            return;
+        }
+        if (buffers[slot] == id)
+        {
+            frame.elided++;
+            return;
+        }
+        buffers[slot] = id;
+        frame.issued++;
+        glBindBuffer(target, id);
+    }
+
+    // indexed binding points are not shadowed, but binding one also sets the generic binding
+    void bindBufferBase(GLenum target, GLuint index, GLuint id)
+    {
+        const int slot = bufferSlot(target);
+        if (slot >= 0)
+            buffers[slot] = id;
+        frame.issued++;
+        glBindBufferBase(target, index, id);
+    }
+
+    // bind a texture to a unit, switching the active unit only when needed
+    void bindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        const int slot = textureSlot(target);
+        if (slot >= 0 && unit < MAX_TEXTURE_UNITS && textures[unit][slot] == id)
+        {
+            frame.elided++;
+            return;
+        }
+        activeTexture(unit);
+        if (slot >= 0 && unit < MAX_TEXTURE_UNITS)
+            textures[unit][slot] = id;
+        frame.issued++;
+        glBindTexture(target, id);
+    }
+
+    // bind for glTexImage2D and friends. Those act on the active unit, so unlike a bind for
+    // drawing this has to select the unit as well.
+    void bindTextureForUpdate(GLenum target, GLuint id)
+    {
+        activeTexture(0);
+        bindTexture(0, target, id);
+    }
+
+    void enable(GLenum capability)
+    {
+        setCapability(capability, true);
+    }
+    void disable(GLenum capability)
+    {
+        setCapability(capability, false);
+    }
+
+    // GL unbinds deleted objects, so clear them from the shadow state as well
+    void deleteTexture(GLuint id)
+    {
+        for (auto& unit : textures)
+            for (auto& texture : unit)
+                if (texture == id)
+                    texture = 0;
+        glDeleteTextures(1, &id);
+    }
+    void deleteBuffer(GLuint id)
+    {
+        for (auto& buffer : buffers)
+            if (buffer == id)
+                buffer = 0;
+        glDeleteBuffers(1, &id);
+    }
+    void deleteVertexArray(GLuint id)
+    {
+        if (vertexArray == id)
+            vertexArray = 0;
+        glDeleteVertexArrays(1, &id);
+    }
+    void deleteProgram(GLuint id)
+    {
+        if (program == id)
+            program = 0;
+        glDeleteProgram(id);
+    }
+
+    GLuint currentProgram() const { return program; }
+    GLuint currentVertexArray() const { return vertexArray; }
+
+    // call once per frame, the counts of the finished frame stay readable through lastFrame()
+    void endFrame()
+    {
+        previous = frame;
+        total.issued += frame.issued;
+        total.elided += frame.elided;
+        frame = Stats{};
+        frames++;
+    }
+    const Stats& lastFrame() const { return previous; }
+    const Stats& totals() const { return total; }
+    uint32_t frameCount() const { return frames; }
+
+private:
+    static constexpr GLuint UNKNOWN = 0xFFFFFFFFu;
+    static constexpr int TEXTURE_TARGETS = 4;
+    static constexpr int BUFFER_TARGETS = 6;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGETS];
+    GLuint buffers[BUFFER_TARGETS];
+    std::vector<std::pair<GLenum, bool>> capabilities;
+
+    Stats frame, previous, total;
+    uint32_t frames = 0;
+
+    static int textureSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        case GL_TEXTURE_CUBE_MAP: return 2;
+        case GL_TEXTURE_3D: return 3;
+        default: return -1;
+        }
+    }
+
+    static int bufferSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_ELEMENT_ARRAY_BUFFER: return 1;
+        case GL_UNIFORM_BUFFER: return 2;
+        case GL_PIXEL_UNPACK_BUFFER: return 3;
+        case GL_PIXEL_PACK_BUFFER: return 4;
+        case GL_COPY_WRITE_BUFFER: return 5;
+        default: return -1;
+        }
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if (activeUnit == unit)
+            return;
+        activeUnit = unit;
+        frame.issued++;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void setCapability(GLenum capability, bool on)
+    {
+        for (auto& entry : capabilities)
+        {
+            if (entry.first == capability)
+            {
+                if (entry.second == on)
+                {
+                    frame.elided++;
+                    return;
+                }
+                entry.second = on;
+                frame.issued++;
+                on ? glEnable(capability) : glDisable(capability);
+                return;
+            }
+        }
+        capabilities.emplace_back(capability, on);
+        frame.issued++;
+        on ? glEnable(capability) : glDisable(capability);
+    }
+};
+
+// the one state cache for the GL context
+inline GLStateCache glState;
+
+#endif
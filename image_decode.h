@@ -0,0 +1,229 @@
+#ifndef IMAGE_DECODE_H
+#define IMAGE_DECODE_H
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Settings for one decode. stb_image keeps its settings in globals, this goes through the per
+// thread versions instead (the implementation is built with STBI_THREAD_LOCAL) and sets them on
+// every call, so decoders on different threads can use different settings and nothing
+// leaks from one load into the next.
+struct ImageDecodeOptions
+{
+    bool flipVertically = false;
+    int desiredChannels = 0; // 0 keeps the channel count of the file
+};
+
+// the whole file, for decoding from memory or hashing. False if it can't be read.
+inline bool ReadFileBytes(const char* fileName, std::vector<unsigned char>& bytes)
+{
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+    bytes.resize((size_t)file.tellg());
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    return (bool)file;
+}
+
+// Scratch memory for stb_image. The implementation in test.cpp sends STBI_MALLOC/REALLOC/FREE
+// here; while an ImageDecoder is bound to the thread, what stb frees (coefficient planes, line
+// buffers, the inflated PNG stream, ...) stays in the decoder for the next image instead of
+// going back to the heap. Unbound, these are plain malloc/free. Every block carries a small
+// header with its capacity, so blocks can be freed under any binding, or none.
+class ImageScratchPool
+{
+public:
+    // a decode of a 4K RGBA image needs about this much
+    static constexpr size_t DEFAULT_MAX_BYTES = 64u << 20;
+
+    explicit ImageScratchPool(size_t maxBytes = DEFAULT_MAX_BYTES) : maxBytes(maxBytes) {}
+    ~ImageScratchPool()
+    {
+        for (Header* block : blocks)
+            std::free(block);
+    }
+
+    ImageScratchPool(const ImageScratchPool&) = delete;
+    ImageScratchPool& operator=(const ImageScratchPool&) = delete;
+
+    // the smallest kept block that fits, nullptr if none does
+    void* take(size_t size)
+    {
+        auto best = blocks.end();
+        for (auto it = blocks.begin(); it != blocks.end(); ++it)
+            if ((*it)->capacity >= size && (best == blocks.end() || (*it)->capacity < (*best)->capacity))
+                best = it;
+        if (best == blocks.end())
+            return nullptr;
+        Header* block = *best;
+        *best = blocks.back();
+        blocks.pop_back();
+        keptBytes -= block->capacity;
+        return block + 1;
+    }
+
+    // false if the pool is full, by count or by bytes, the caller frees the block then
+    bool keep(void* pointer)
+    {
+        Header* block = static_cast<Header*>(pointer) - 1;
+        if (blocks.size() >= MAX_BLOCKS || keptBytes + block->capacity > maxBytes)
+            return false;
+        blocks.push_back(block);
+        keptBytes += block->capacity;
+        return true;
+    }
+
+    // free kept blocks, the biggest first, until at most bytes are left
+    void trim(size_t bytes = 0)
+    {
+        std::sort(blocks.begin(), blocks.end(), [](const Header* a, const Header* b) { return a->capacity < b->capacity; });
+        while (keptBytes > bytes && !blocks.empty())
+        {
+            keptBytes -= blocks.back()->capacity;
+            std::free(blocks.back());
+            blocks.pop_back();
+        }
+    }
+
+    size_t retainedBytes() const { return keptBytes; }
+    size_t maxRetainedBytes() const { return maxBytes; }
+
+    // 16 bytes, so the memory after it keeps malloc's alignment
+    struct alignas(16) Header
+    {
+        size_t capacity;
+    };
+
+    // the pool bound to this thread, if any
+    static ImageScratchPool*& Bound()
+    {
+        static thread_local ImageScratchPool* pool = nullptr;
+        return pool;
+    }
+
+private:
+    // a decode needs a dozen or so buffers, more than this means callers keep results around
+    static constexpr size_t MAX_BLOCKS = 32;
+
+    std::vector<Header*> blocks;
+    size_t keptBytes = 0;
+    size_t maxBytes;
+};
+
+inline void* ImageScratchAllocate(size_t size)
+{
+    if (ImageScratchPool* pool = ImageScratchPool::Bound())
+        if (void* pointer = pool->take(size))
+            return pointer;
+    auto* block = static_cast<ImageScratchPool::Header*>(std::malloc(sizeof(ImageScratchPool::Header) + size));
+    if (!block)
+        return nullptr;
+    block->capacity = size;
+    return block + 1;
+}
+
+inline void ImageScratchFree(void* pointer)
+{
+    if (!pointer)
+        return;
+    ImageScratchPool* pool = ImageScratchPool::Bound();
+    if (!pool || !pool->keep(pointer))
+        std::free(static_cast<ImageScratchPool::Header*>(pointer) - 1);
+}
+
+inline void* ImageScratchReallocate(void* pointer, size_t size)
+{
+    if (!pointer)
+        return ImageScratchAllocate(size);
+    const size_t capacity = (static_cast<ImageScratchPool::Header*>(pointer) - 1)->capacity;
+    if (size <= capacity)
+        return pointer;
+    void* grown = ImageScratchAllocate(size);
+    if (!grown)
+        return nullptr; // like realloc, the old block is still the caller's
+    memcpy(grown, pointer, capacity);
+    ImageScratchFree(pointer);
+    return grown;
+}
+
+// stbi_load_from_memory with options. Free the result with stbi_image_free.
+inline unsigned char* DecodeImage(const unsigned char* bytes, size_t size, const ImageDecodeOptions& options,
+                                  int* width, int* height, int* channels)
+{
+    stbi_set_flip_vertically_on_load_thread(options.flipVertically);
+    return stbi_load_from_memory(bytes, (int)size, width, height, channels, options.desiredChannels);
+}
+
+// stbi_load with options. Free the result with stbi_image_free.
+inline unsigned char* DecodeImageFile(const char* fileName, const ImageDecodeOptions& options,
+                                      int* width, int* height, int* channels)
+{
+    stbi_set_flip_vertically_on_load_thread(options.flipVertically);
+    return stbi_load(fileName, width, height, channels, options.desiredChannels);
+}
+
+// A decoder that keeps its scratch memory between images and can decode straight into memory
+// the caller owns, such as a mapped pixel unpack buffer or an arena. Flipping happens as the
+// rows are written, there is no pass over the finished image. Not thread safe, give each
+// thread its own.
+class ImageDecoder
+{
+public:
+    // keeps at most maxRetainedBytes of scratch between images
+    explicit ImageDecoder(size_t maxRetainedBytes = ImageScratchPool::DEFAULT_MAX_BYTES) : pool(maxRetainedBytes) {}
+    ImageDecoder(const ImageDecoder&) = delete;
+    ImageDecoder& operator=(const ImageDecoder&) = delete;
+
+    // the bytes decodeInto will write, from the header alone. 0 if it can't be read.
+    static size_t DecodedSize(const unsigned char* bytes, size_t size, const ImageDecodeOptions& options,
+                              int* width, int* height, int* channels)
+    {
+        if (!stbi_info_from_memory(bytes, (int)size, width, height, channels))
+            return 0;
+        const int written = options.desiredChannels ? options.desiredChannels : *channels;
+        return (size_t)*width * *height * written;
+    }
+
+    // decode into destination, tightly packed rows of options.desiredChannels (or the file's
+    // channel count). False if the image is bad or doesn't fit in capacity bytes.
+    bool decodeInto(const unsigned char* bytes, size_t size, const ImageDecodeOptions& options,
+                    unsigned char* destination, size_t capacity, int* width, int* height, int* channels)
+    {
+        const Binding binding(pool);
+        stbi_set_flip_vertically_on_load_thread(options.flipVertically);
+        return stbi_load_from_memory_into(bytes, (int)size, destination, capacity,
+                                          width, height, channels, options.desiredChannels) != 0;
+    }
+
+    // DecodeImage with this decoder's scratch. Free the result with stbi_image_free.
+    unsigned char* decode(const unsigned char* bytes, size_t size, const ImageDecodeOptions& options,
+                          int* width, int* height, int* channels)
+    {
+        const Binding binding(pool);
+        return DecodeImage(bytes, size, options, width, height, channels);
+    }
+
+    size_t retainedBytes() const { return pool.retainedBytes(); }
+    // give back the scratch beyond bytes, after an unusually big image or when done decoding
+    void trim(size_t bytes = 0) { pool.trim(bytes); }
+
+private:
+    // binds the pool for the length of a call, restoring whatever was bound before
+    struct Binding
+    {
+        explicit Binding(ImageScratchPool& pool) : previous(ImageScratchPool::Bound()) { ImageScratchPool::Bound() = &pool; }
+        ~Binding() { ImageScratchPool::Bound() = previous; }
+        ImageScratchPool* previous;
+    };
+
+    ImageScratchPool pool;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef IMAGE_PROBE_H
+#define IMAGE_PROBE_H
+
+#include "stb_image.h"
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+// What an image file holds, read from its header without decoding it: enough to size the
+// texture storage, the decode buffer and an atlas slot before any pixels exist.
+struct ImageProbe
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;       // in the file; paletted images count what the palette holds
+    int bitsPerChannel = 0; // 8, or 16 for 16 bit PNG/PSD/PNM
+    bool hdr = false;       // float data (Radiance .hdr), stbi_load tone maps it to 8 bits
+
+    bool valid() const { return width > 0 && height > 0; }
+    // the bytes the 8 bit decoders produce, with desiredChannels like stbi_load takes it
+    size_t decodedSize(int desiredChannels = 0) const
+    {
+        return (size_t)width * height * (desiredChannels ? desiredChannels : channels);
+    }
+};
+
+// an invalid probe if the header can't be read or the format isn't one stb_image knows
+inline ImageProbe ProbeImage(const unsigned char* bytes, size_t size)
+{
+    ImageProbe probe;
+    if (!stbi_info_from_memory(bytes, (int)size, &probe.width, &probe.height, &probe.channels))
+        return ImageProbe{};
+    probe.bitsPerChannel = stbi_is_16_bit_from_memory(bytes, (int)size) ? 16 : 8;
+    probe.hdr = stbi_is_hdr_from_memory(bytes, (int)size) != 0;
+    return probe;
+}
+
+// the file is mapped, so only the pages the header sits in are read
+inline ImageProbe ProbeImageFile(const char* path)
+{
+    const MappedFile file(path);
+    if (!file.valid())
+        return ImageProbe{};
+    return ProbeImage(file.data(), file.size());
+}
+
+// Probes by path, each file read once. Build it up front for every image the scene uses and the
+// layout (texture storage, atlas pages, decode buffers) can be settled before decoding starts.
+class ImageIndex
+{
+public:
+    // the probe for path, probing it the first time. Invalid, with an error, if it can't be read.
+    const ImageProbe& add(const std::string& path)
+    {
+        auto found = probes.find(path);
+        if (found != probes.end())
+            return found->second;
+        const ImageProbe probe = ProbeImageFile(path.c_str());
+        if (!probe.valid())
+            std::cout << "ERROR::IMAGE_INDEX::PROBE_FAILED " << path << std::endl;
+        return probes.emplace(path, probe).first->second;
+    }
+
+    // nullptr if path was never added
+    const ImageProbe* find(const std::string& path) const
+    {
+        auto found = probes.find(path);
+        return found == probes.end() ? nullptr : &found->second;
+    }
+
+    size_t size() const { return probes.size(); }
+    const std::unordered_map<std::string, ImageProbe>& entries() const { return probes; }
+
+private:
+    std::unordered_map<std::string, ImageProbe> probes;
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef INSTANCED_MESH_H
+#define INSTANCED_MESH_H
+
+#include <glad/glad.h>
+#include <Eigen/Dense>
+#include "gl_state.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Draws many copies of an indexed mesh with one glDrawElementsInstanced. The mesh gets a VAO of
+// its own that reads the same vertex and element buffers as the one it is made from, plus the
+// per instance model matrices from their own buffer as a mat4 attribute with divisor 1 (see
+// vertex_instanced.vert). The source VAO is left as it was for ordinary draws.
+class InstancedMesh
+{
+public:
+    // sourceArray must already have its vertex and element buffers set up, its attributes below
+    // firstAttribute are copied. The matrix takes the four locations starting at firstAttribute.
+    InstancedMesh(GLuint sourceArray, GLsizei indexCount, GLuint firstAttribute = 3)
+        : indexCount(indexCount), firstAttribute(firstAttribute)
+    {
+        glGenBuffers(1, &instanceBuffer);
+        glGenVertexArrays(1, &vertexArray);
+        copyVertexAttributes(sourceArray);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(firstAttribute + column);
+            glVertexAttribDivisor(firstAttribute + column, 1);
+        }
+        pointAttributes(instanceBuffer, 0);
+    }
+
+    ~InstancedMesh()
+    {
+        glState.deleteVertexArray(vertexArray);
+        glState.deleteBuffer(instanceBuffer);
+    }
+
+    InstancedMesh(const InstancedMesh&) = delete;
+    InstancedMesh& operator=(const InstancedMesh&) = delete;
+
+    // upload the transforms for the next draws. The buffer is orphaned when it has to grow,
+    // otherwise updated in place.
+    void setInstances(const Eigen::Matrix4f* transforms, size_t count)
+    {
+        baseInstance = 0;
+        if (source != instanceBuffer || sourceOffset != 0)
+            pointAttributes(instanceBuffer, 0);
+        glState.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        const size_t bytes = count * sizeof(Eigen::Matrix4f);
+        if (count > capacity)
+        {
+            glBufferData(GL_ARRAY_BUFFER, bytes, transforms, GL_STREAM_DRAW);
+            capacity = count;
+        }
+        else if (count > 0)
+        {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, transforms);
+        }
+        instanceCount = count;
+    }
+
+    // draw transforms that were already written somewhere else, e.g. a StreamBuffer allocation
+    // With GL 4.2 a matrix aligned offset becomes the base instance, so the attributes only
+    // have to be re-pointed when the buffer changes, not every frame.
+    void setInstances(GLuint buffer, GLintptr offset, size_t count)
+    {
+        baseInstance = 0;
+        if (GLAD_GL_VERSION_4_2 && offset % sizeof(Eigen::Matrix4f) == 0)
+        {
+            baseInstance = (GLuint)(offset / sizeof(Eigen::Matrix4f));
+            offset = 0;
+        }
+        if (source != buffer || sourceOffset != offset)
+            pointAttributes(buffer, offset);
+        instanceCount = count;
+    }
+
+    // the instancing program must be in use
+    void draw() const
+    {
+        if (instanceCount == 0)
+            return;
+        glState.bindVertexArray(vertexArray);
+        if (baseInstance > 0)
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, (GLsizei)instanceCount, baseInstance);
+        else
+            glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0, (GLsizei)instanceCount);
+    }
+
+    size_t count() const { return instanceCount; }
+    GLuint buffer() const { return instanceBuffer; }
+    GLuint vertexArrayObject() const { return vertexArray; }
+
+private:
+    GLuint vertexArray = 0;
+    GLsizei indexCount;
+    GLuint firstAttribute;
+    GLuint source = 0;
+    GLintptr sourceOffset = -1;
+    GLuint instanceBuffer = 0;
+    size_t capacity = 0;
+    size_t instanceCount = 0;
+    GLuint baseInstance = 0;
+
+    // the element buffer and the enabled attributes below firstAttribute of source, read back
+    // from GL and set up the same way on this mesh's VAO, which is left bound
+    void copyVertexAttributes(GLuint source)
+    {
+        struct Attribute
+        {
+            GLint enabled, size, type, normalized, stride, buffer, integer;
+            void* pointer;
+        };
+        glState.bindVertexArray(source);
+        GLint elementBuffer = 0;
+        glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elementBuffer);
+        Attribute attributes[16] = {};
+        const GLuint count = firstAttribute < 16 ? firstAttribute : 16;
+        for (GLuint i = 0; i < count; i++)
+        {
+            Attribute& attribute = attributes[i];
+            glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &attribute.enabled);
+            if (!attribute.enabled)
+                continue;
+            glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_SIZE, &attribute.size);
+            glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_TYPE, &attribute.type);
+            glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, &attribute.normalized);
+            glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &attribute.stride);
+            glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &attribute.buffer);
+            glGetVertexAttribiv(i, GL_VERTEX_ATTRIB_ARRAY_INTEGER, &attribute.integer);
+            glGetVertexAttribPointerv(i, GL_VERTEX_ATTRIB_ARRAY_POINTER, &attribute.pointer);
+        }
+
+        glState.bindVertexArray(vertexArray);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, (GLuint)elementBuffer);
+        for (GLuint i = 0; i < count; i++)
+        {
+            const Attribute& attribute = attributes[i];
+            if (!attribute.enabled)
+                continue;
+            glState.bindBuffer(GL_ARRAY_BUFFER, (GLuint)attribute.buffer);
+            if (attribute.integer)
+                glVertexAttribIPointer(i, attribute.size, (GLenum)attribute.type, attribute.stride, attribute.pointer);
+            else
+                glVertexAttribPointer(i, attribute.size, (GLenum)attribute.type, (GLboolean)attribute.normalized,
+                                      attribute.stride, attribute.pointer);
+            glEnableVertexAttribArray(i);
+        }
+    }
+
+    void pointAttributes(GLuint buffer, GLintptr offset)
+    {
+        glState.bindVertexArray(vertexArray);
+        glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            glVertexAttribPointer(firstAttribute + column, 4, GL_FLOAT, GL_FALSE, sizeof(Eigen::Matrix4f),
+                                  (void*)(offset + column * 4 * sizeof(float)));
+        }
+        source = buffer;
+        sourceOffset = offset;
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed pool of worker threads. submit() queues fire and forget jobs, parallelFor() splits a
+// range into chunks that the workers and the calling thread take turns on.
+class JobSystem
+{
+public:
+    // by default one worker per core, minus the calling thread
+    explicit JobSystem(unsigned threads = 0)
+    {
+        if (threads == 0)
+        {
+            const unsigned cores = std::thread::hardware_concurrency();
+            threads = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned i = 0; i < threads; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    void submit(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+            outstanding++;
+        }
+        wake.notify_one();
+    }
+
+    // block until every submitted job has finished
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return outstanding == 0; });
+    }
+
+    // run function(begin, end) over [0, count) in chunks of at most grain items.
+    // Returns when the whole range is done. Do not call from inside a job.
+    template <typename Function>
+    void parallelFor(size_t count, size_t grain, Function&& function)
+    {
+        if (count == 0)
+            return;
+        grain = std::max<size_t>(grain, 1);
+        const size_t chunks = (count + grain - 1) / grain;
+        if (chunks == 1 || workers.empty())
+        {
+            function((size_t)0, count);
+            return;
+        }
+
+        auto state = std::make_shared<ForState>();
+        auto work = [&function, &state = *state, chunks, grain, count]()
+        {
+            for (size_t chunk = state.next.fetch_add(1); chunk < chunks; chunk = state.next.fetch_add(1))
+            {
+                const size_t begin = chunk * grain;
+                function(begin, std::min(begin + grain, count));
+                state.done.fetch_add(1, std::memory_order_release);
+            }
+        };
+        const size_t helpers = std::min<size_t>(workers.size(), chunks - 1);
+        for (size_t i = 0; i < helpers; i++)
+        {
+            submit([state, &work]
+            {
+                // a helper that only gets scheduled after the loop is over must not touch
+                // work, which lives on the caller's stack
+                state->active.fetch_add(1);
+                if (!state->closed.load())
+                    work();
+                state->active.fetch_sub(1);
+            });
+        }
+        work();
+        while (state->done.load(std::memory_order_acquire) < chunks)
+            std::this_thread::yield();
+        state->closed.store(true);
+        while (state->active.load() > 0)
+            std::this_thread::yield();
+    }
+
+    unsigned threadCount() const { return (unsigned)workers.size(); }
+
+private:
+    struct ForState
+    {
+        std::atomic<size_t> next{ 0 };
+        std::atomic<size_t> done{ 0 };
+        std::atomic<int> active{ 0 };
+        std::atomic<bool> closed{ false };
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t outstanding = 0;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--outstanding == 0)
+                    idle.notify_all();
+            }
+        }
+    }
+};
+
+#endif
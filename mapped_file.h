@@ -0,0 +1,105 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <iostream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+// glad defines APIENTRY as well, windows.h's definition means the same thing
+#ifdef APIENTRY
+#undef APIENTRY
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read only. The pages come in from the OS file cache as they are touched,
+// so nothing is read or copied up front.
+class MappedFile
+{
+public:
+    explicit MappedFile(const char* path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping)
+            return;
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!view)
+        {
+            std::cout << "ERROR::MAPPED_FILE::MAP_FAILED " << path << std::endl;
+            return;
+        }
+        bytes = static_cast<const unsigned char*>(view);
+        length = (size_t)fileSize.QuadPart;
+#else
+        descriptor = open(path, O_RDONLY);
+        if (descriptor < 0)
+            return;
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size == 0)
+            return;
+        void* view = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (view == MAP_FAILED)
+        {
+            std::cout << "ERROR::MAPPED_FILE::MAP_FAILED " << path << std::endl;
+            return;
+        }
+        bytes = static_cast<const unsigned char*>(view);
+        length = (size_t)status.st_size;
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (bytes)
+            munmap(const_cast<unsigned char*>(bytes), length);
+        if (descriptor >= 0)
+            close(descriptor);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // nullptr if the file is missing, empty or could not be mapped
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+    bool valid() const { return bytes != nullptr; }
+
+private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int descriptor = -1;
+#endif
+};
+
+#endif
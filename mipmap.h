@@ -0,0 +1,555 @@
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include <glad/glad.h>
+#include "simd.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// CPU mip chain builder, the replacement for glGenerateMipmap. Each level is filtered from the
+// one above it, a couple of rows at a time in float RGBA, so an 8K image never needs more than
+// a few rows of float scratch. It touches no GL state and keeps nothing between calls, so it
+// runs on worker threads as well as at import time. The row kernels use AVX2 or SSE2, see simd.h.
+
+enum class MipFilter
+{
+    Box,    // 2x2 average, what glGenerateMipmap does
+    Kaiser  // 8 tap Kaiser windowed sinc, sharper and with less aliasing
+};
+
+struct MipmapOptions
+{
+    MipFilter filter = MipFilter::Box;
+    // the color channels are sRGB encoded: average them in linear light and encode again
+    bool srgb = false;
+    // above 0, scale alpha on every level so the share of texels with alpha above the cutoff
+    // stays that of the top level. Keeps alpha tested foliage from thinning out in the distance.
+    float alphaCutoff = 0.0f;
+};
+
+struct MipLevel
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels; // tightly packed, same channel count as the source
+};
+
+// the tables to go between 8 bit and float, shared by every builder
+struct MipTables
+{
+    static constexpr int ENCODE_SIZE = 16384;
+    float unorm[256];
+    float srgbToLinear[256];
+    unsigned char linearToSrgb[ENCODE_SIZE]; // indexed by linear * (ENCODE_SIZE - 1)
+    unsigned char identity[256];             // so linear channels go through a table as well
+
+    MipTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            const float value = i / 255.0f;
+            unorm[i] = value;
+            identity[i] = (unsigned char)i;
+            srgbToLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < ENCODE_SIZE; i++)
+        {
+            const float linear = (float)i / (ENCODE_SIZE - 1);
+            const float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+            linearToSrgb[i] = (unsigned char)(encoded * 255.0f + 0.5f);
+        }
+    }
+};
+
+inline const MipTables& GetMipTables()
+{
+    static const MipTables tables;
+    return tables;
+}
+
+// one level down from the previous one, gl style: halve and round down, never below 1
+inline int MipExtent(int extent)
+{
+    return std::max(extent / 2, 1);
+}
+
+inline int MipLevelCount(int width, int height)
+{
+    int levels = 1;
+    while (width > 1 || height > 1)
+    {
+        width = MipExtent(width);
+        height = MipExtent(height);
+        levels++;
+    }
+    return levels;
+}
+
+class MipChainBuilder
+{
+public:
+    static constexpr int KAISER_TAPS = 8;
+
+    // vectorized = false runs the plain C++ row kernels, the reference the SIMD ones are
+    // checked and benchmarked against
+    MipChainBuilder(int channels, const MipmapOptions& options, bool vectorized = true)
+        : channels(channels), options(options), vectorized(vectorized)
+    {
+#if defined(SIMD_AVX2)
+        avx2 = vectorized && SimdHasAvx2();
+#endif
+        const MipTables& tables = GetMipTables();
+        const bool hasAlpha = channels == 2 || channels == 4;
+        for (int c = 0; c < 4; c++)
+        {
+            const bool isAlpha = hasAlpha && c == channels - 1;
+            srgbChannel[c] = options.srgb && !isAlpha && c < channels;
+            decodeTable[c] = srgbChannel[c] ? tables.srgbToLinear : tables.unorm;
+            encodeTable[c] = srgbChannel[c] ? tables.linearToSrgb : tables.identity;
+        }
+        alphaChannel = hasAlpha ? channels - 1 : -1;
+        KaiserWeights(kaiser);
+    }
+
+    // levels 1 and down of a tightly packed 8 bit image, level 0 being the image itself. A
+    // maxLevels above 0 stops the chain once it holds that many levels, counting level 0.
+    std::vector<MipLevel> build(const unsigned char* pixels, int width, int height, int maxLevels = 0)
+    {
+        int levelCount = MipLevelCount(width, height);
+        if (maxLevels > 0)
+            levelCount = std::min(levelCount, maxLevels);
+        std::vector<MipLevel> levels;
+        levels.reserve(levelCount - 1);
+        float coverage = 0.0f;
+        const bool keepCoverage = options.alphaCutoff > 0.0f && alphaChannel >= 0;
+        if (keepCoverage)
+            coverage = alphaCoverage(pixels, width, height, 1.0f);
+
+        const unsigned char* source = pixels;
+        while ((int)levels.size() + 1 < levelCount)
+        {
+            MipLevel level;
+            level.width = MipExtent(width);
+            level.height = MipExtent(height);
+            level.pixels.resize((size_t)level.width * level.height * channels);
+            if (options.filter == MipFilter::Kaiser)
+                downsampleKaiser(source, width, height, level);
+            else
+                downsampleBox(source, width, height, level);
+            if (keepCoverage)
+                keepAlphaCoverage(level, coverage);
+            levels.push_back(std::move(level));
+            source = levels.back().pixels.data();
+            width = levels.back().width;
+            height = levels.back().height;
+        }
+        return levels;
+    }
+
+private:
+    int channels;
+    MipmapOptions options;
+    bool vectorized;
+    bool avx2 = false; // vectorized and the CPU runs AVX2
+    bool srgbChannel[4];
+    const float* decodeTable[4];
+    const unsigned char* encodeTable[4];
+    int alphaChannel;
+    float kaiser[KAISER_TAPS];
+    // float RGBA rows: decoded source rows, filtered rows and the output row
+    std::vector<float> rowA, rowB, rowOut;
+    std::vector<int32_t> rowCodes;
+    // horizontally filtered source rows for the Kaiser filter, slot = source row % KAISER_TAPS
+    std::vector<float> ring;
+    int ringRow[KAISER_TAPS];
+
+    // windowed sinc for a 2:1 reduction, taps at -3.5 .. 3.5 source texels from the center of
+    // the output texel
+    static void KaiserWeights(float* weights)
+    {
+        const double alpha = 4.0, width = KAISER_TAPS / 2;
+        auto besselI0 = [](double x)
+        {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; k < 20; k++)
+            {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        double total = 0.0;
+        double raw[KAISER_TAPS];
+        for (int k = 0; k < KAISER_TAPS; k++)
+        {
+            const double t = k - (KAISER_TAPS - 1) / 2.0;
+            const double x = 3.14159265358979 * t / 2.0;
+            const double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+            const double r = t / width;
+            const double window = besselI0(alpha * std::sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(alpha);
+            raw[k] = sinc * window;
+            total += raw[k];
+        }
+        for (int k = 0; k < KAISER_TAPS; k++)
+            weights[k] = (float)(raw[k] / total);
+    }
+
+    // the per texel loops with the channel count known at compile time
+    template <int Channels>
+    void decodeTexels(const unsigned char* source, int width, float* out) const
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const unsigned char* texel = source + (size_t)x * Channels;
+            float* value = out + (size_t)x * 4;
+            for (int c = 0; c < Channels; c++)
+                value[c] = decodeTable[c][texel[c]];
+            for (int c = Channels; c < 4; c++)
+                value[c] = 0.0f;
+        }
+    }
+
+    template <int Channels>
+    void encodeTexels(const int32_t* codes, int width, unsigned char* out) const
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const int32_t* code = codes + (size_t)x * 4;
+            unsigned char* texel = out + (size_t)x * Channels;
+            for (int c = 0; c < Channels; c++)
+                texel[c] = encodeTable[c][code[c]];
+        }
+    }
+
+    void decodeRow(const unsigned char* source, int width, float* out) const
+    {
+        switch (channels)
+        {
+        case 1: decodeTexels<1>(source, width, out); break;
+        case 2: decodeTexels<2>(source, width, out); break;
+        case 3: decodeTexels<3>(source, width, out); break;
+        default: decodeTexels<4>(source, width, out); break;
+        }
+    }
+
+    // float RGBA back to 8 bit, sRGB channels through the encode table
+    void encodeRow(const float* in, int width, unsigned char* out)
+    {
+        const float linearScale = 255.0f, srgbScale = MipTables::ENCODE_SIZE - 1;
+        float scale[4];
+        for (int c = 0; c < 4; c++)
+            scale[c] = srgbChannel[c] ? srgbScale : linearScale;
+        const size_t count = (size_t)width * 4;
+        rowCodes.resize(count);
+        int32_t* codes = rowCodes.data();
+        size_t i = 0;
+#if defined(SIMD_AVX2)
+        if (avx2)
+            i = encodeCodesAvx2(in, scale, codes, count);
+#endif
+#if defined(SIMD_SSE2)
+        if (vectorized)
+        {
+            const __m128 scales = _mm_setr_ps(scale[0], scale[1], scale[2], scale[3]);
+            const __m128 half = _mm_set1_ps(0.5f), zero = _mm_setzero_ps();
+            for (; i + 4 <= count; i += 4)
+            {
+                const __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), zero), _mm_set1_ps(1.0f));
+                const __m128i code = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, scales), half));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(codes + i), code);
+            }
+        }
+#endif
+        for (; i < count; i++)
+        {
+            const float v = std::min(std::max(in[i], 0.0f), 1.0f);
+            codes[i] = (int32_t)(v * scale[i & 3] + 0.5f);
+        }
+
+        switch (channels)
+        {
+        case 1: encodeTexels<1>(codes, width, out); break;
+        case 2: encodeTexels<2>(codes, width, out); break;
+        case 3: encodeTexels<3>(codes, width, out); break;
+        default: encodeTexels<4>(codes, width, out); break;
+        }
+    }
+
+#if defined(SIMD_AVX2)
+    // The AVX2 halves of the row kernels, each returns where the SSE2 and scalar loops take
+    // over. Built for AVX2 whatever the compiler targets, called only when avx2 is set.
+    SIMD_AVX2_TARGET static size_t encodeCodesAvx2(const float* in, const float (&scale)[4], int32_t* codes, size_t count)
+    {
+        const __m256 scales = _mm256_setr_ps(scale[0], scale[1], scale[2], scale[3], scale[0], scale[1], scale[2], scale[3]);
+        const __m256 half = _mm256_set1_ps(0.5f), zero = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            const __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(in + i), zero), _mm256_set1_ps(1.0f));
+            const __m256i code = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, scales), half));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(codes + i), code);
+        }
+        return i;
+    }
+
+    SIMD_AVX2_TARGET static int boxRowAvx2(const float* a, const float* b, int pairs, float* out)
+    {
+        const __m256 quarter = _mm256_set1_ps(0.25f);
+        int x = 0;
+        for (; x + 2 <= pairs; x += 2)
+        {
+            const __m256 s0 = _mm256_add_ps(_mm256_loadu_ps(a + x * 8), _mm256_loadu_ps(b + x * 8));
+            const __m256 s1 = _mm256_add_ps(_mm256_loadu_ps(a + x * 8 + 8), _mm256_loadu_ps(b + x * 8 + 8));
+            // texels 2x and 2x + 2 in one register, 2x + 1 and 2x + 3 in the other
+            const __m256 even = _mm256_permute2f128_ps(s0, s1, 0x20);
+            const __m256 odd = _mm256_permute2f128_ps(s0, s1, 0x31);
+            _mm256_storeu_ps(out + x * 4, _mm256_mul_ps(_mm256_add_ps(even, odd), quarter));
+        }
+        return x;
+    }
+
+    // output texels [x, end) of the horizontal Kaiser pass, all of whose taps land inside the row
+    SIMD_AVX2_TARGET int kaiserRowAvx2(const float* in, int x, int end, float* out) const
+    {
+        for (; x + 2 <= end; x += 2)
+        {
+            // two output texels, two source texels apart
+            const float* texel = in + (2 * x - 3) * 4;
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < KAISER_TAPS; k++)
+            {
+                const __m256 pair = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(texel + k * 4)),
+                                                         _mm_loadu_ps(texel + k * 4 + 8), 1);
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(kaiser[k]), pair));
+            }
+            _mm256_storeu_ps(out + x * 4, sum);
+        }
+        return x;
+    }
+
+    SIMD_AVX2_TARGET size_t kaiserColumnAvx2(const float* const* rows, size_t count, float* out) const
+    {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < KAISER_TAPS; k++)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(kaiser[k]), _mm256_loadu_ps(rows[k] + i)));
+            _mm256_storeu_ps(out + i, sum);
+        }
+        return i;
+    }
+#endif
+
+    // 2x2 average of two float RGBA source rows into one output row. Adds (a0 + b0) + (a1 + b1)
+    // in every path so the SIMD results match the reference bit for bit.
+    void boxRow(const float* a, const float* b, int width, int outWidth, float* out) const
+    {
+        int x = 0;
+        const int pairs = std::min(width / 2, outWidth);
+#if defined(SIMD_AVX2)
+        if (avx2)
+            x = boxRowAvx2(a, b, pairs, out);
+#endif
+#if defined(SIMD_SSE2)
+        if (vectorized)
+        {
+            const __m128 quarter = _mm_set1_ps(0.25f);
+            for (; x < pairs; x++)
+            {
+                const __m128 even = _mm_add_ps(_mm_loadu_ps(a + x * 8), _mm_loadu_ps(b + x * 8));
+                const __m128 odd = _mm_add_ps(_mm_loadu_ps(a + x * 8 + 4), _mm_loadu_ps(b + x * 8 + 4));
+                _mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(even, odd), quarter));
+            }
+        }
+#endif
+        for (; x < outWidth; x++)
+        {
+            const int x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+            for (int c = 0; c < 4; c++)
+                out[x * 4 + c] = ((a[x0 * 4 + c] + b[x0 * 4 + c]) + (a[x1 * 4 + c] + b[x1 * 4 + c])) * 0.25f;
+        }
+    }
+
+    void downsampleBox(const unsigned char* source, int width, int height, MipLevel& level)
+    {
+        const size_t sourceRow = (size_t)width * channels, outRow = (size_t)level.width * channels;
+        rowA.resize((size_t)width * 4);
+        rowB.resize((size_t)width * 4);
+        rowOut.resize((size_t)level.width * 4);
+        for (int y = 0; y < level.height; y++)
+        {
+            const int y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+            decodeRow(source + y0 * sourceRow, width, rowA.data());
+            decodeRow(source + y1 * sourceRow, width, rowB.data());
+            boxRow(rowA.data(), rowB.data(), width, level.width, rowOut.data());
+            encodeRow(rowOut.data(), level.width, level.pixels.data() + y * outRow);
+        }
+    }
+
+    // one source row through the horizontal Kaiser taps, at the output width
+    void kaiserRow(const float* in, int width, int outWidth, float* out) const
+    {
+        // output texels whose taps all land inside the row
+        const int interiorBegin = 2, interiorEnd = std::max(interiorBegin, (width - 3) / 2);
+        int x = 0;
+        auto clamped = [&](int x)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                float sum = 0.0f;
+                for (int k = 0; k < KAISER_TAPS; k++)
+                {
+                    const int sx = std::min(std::max(2 * x - 3 + k, 0), width - 1);
+                    sum += kaiser[k] * in[sx * 4 + c];
+                }
+                out[x * 4 + c] = sum;
+            }
+        };
+        for (; x < std::min(interiorBegin, outWidth); x++)
+            clamped(x);
+#if defined(SIMD_AVX2)
+        if (avx2)
+            x = kaiserRowAvx2(in, x, std::min(interiorEnd, outWidth), out);
+#endif
+#if defined(SIMD_SSE2)
+        if (vectorized)
+        {
+            for (; x < std::min(interiorEnd, outWidth); x++)
+            {
+                const float* texel = in + (2 * x - 3) * 4;
+                __m128 sum = _mm_setzero_ps();
+                for (int k = 0; k < KAISER_TAPS; k++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(kaiser[k]), _mm_loadu_ps(texel + k * 4)));
+                _mm_storeu_ps(out + x * 4, sum);
+            }
+        }
+#endif
+        for (; x < outWidth; x++)
+            clamped(x);
+    }
+
+    const float* kaiserSourceRow(const unsigned char* source, int width, int row, int outWidth)
+    {
+        const int slot = row % KAISER_TAPS;
+        float* filtered = ring.data() + (size_t)slot * outWidth * 4;
+        if (ringRow[slot] != row)
+        {
+            decodeRow(source + (size_t)row * width * channels, width, rowA.data());
+            kaiserRow(rowA.data(), width, outWidth, filtered);
+            ringRow[slot] = row;
+        }
+        return filtered;
+    }
+
+    void downsampleKaiser(const unsigned char* source, int width, int height, MipLevel& level)
+    {
+        const size_t count = (size_t)level.width * 4, outRow = (size_t)level.width * channels;
+        rowA.resize((size_t)width * 4);
+        rowOut.resize(count);
+        ring.resize(count * KAISER_TAPS);
+        for (int& row : ringRow)
+            row = -1;
+        for (int y = 0; y < level.height; y++)
+        {
+            const float* rows[KAISER_TAPS];
+            for (int k = 0; k < KAISER_TAPS; k++)
+                rows[k] = kaiserSourceRow(source, width, std::min(std::max(2 * y - 3 + k, 0), height - 1), level.width);
+
+            float* out = rowOut.data();
+            size_t i = 0;
+#if defined(SIMD_AVX2)
+            if (avx2)
+                i = kaiserColumnAvx2(rows, count, out);
+#endif
+#if defined(SIMD_SSE2)
+            if (vectorized)
+            {
+                for (; i + 4 <= count; i += 4)
+                {
+                    __m128 sum = _mm_setzero_ps();
+                    for (int k = 0; k < KAISER_TAPS; k++)
+                        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(kaiser[k]), _mm_loadu_ps(rows[k] + i)));
+                    _mm_storeu_ps(out + i, sum);
+                }
+            }
+#endif
+            for (; i < count; i++)
+            {
+                float sum = 0.0f;
+                for (int k = 0; k < KAISER_TAPS; k++)
+                    sum += kaiser[k] * rows[k][i];
+                out[i] = sum;
+            }
+            encodeRow(out, level.width, level.pixels.data() + y * outRow);
+        }
+    }
+
+    static unsigned char scaledAlpha(int alpha, float scale)
+    {
+        return (unsigned char)std::min(alpha * scale + 0.5f, 255.0f);
+    }
+
+    // share of texels whose alpha, scaled, ends up above the cutoff
+    float alphaCoverage(const unsigned char* pixels, int width, int height, float scale) const
+    {
+        uint32_t histogram[256] = {};
+        alphaHistogram(pixels, (size_t)width * height, histogram);
+        return coverageOf(histogram, (size_t)width * height, scale);
+    }
+
+    void alphaHistogram(const unsigned char* pixels, size_t texels, uint32_t* histogram) const
+    {
+        for (size_t i = 0; i < texels; i++)
+            histogram[pixels[i * channels + alphaChannel]]++;
+    }
+
+    float coverageOf(const uint32_t* histogram, size_t texels, float scale) const
+    {
+        const float cutoff = options.alphaCutoff * 255.0f;
+        size_t covered = 0;
+        for (int a = 0; a < 256; a++)
+            if (scaledAlpha(a, scale) > cutoff)
+                covered += histogram[a];
+        return (float)covered / texels;
+    }
+
+    // find the alpha scale that gives the level the target coverage and apply it
+    void keepAlphaCoverage(MipLevel& level, float target) const
+    {
+        const size_t texels = (size_t)level.width * level.height;
+        uint32_t histogram[256] = {};
+        alphaHistogram(level.pixels.data(), texels, histogram);
+        float low = 0.0f, high = 4.0f, scale = 1.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            scale = (low + high) * 0.5f;
+            const float coverage = coverageOf(histogram, texels, scale);
+            if (coverage < target)
+                low = scale;
+            else
+                high = scale;
+        }
+        // coverage is a step function of the scale, take whichever side of the step is closer
+        const float below = coverageOf(histogram, texels, low), above = coverageOf(histogram, texels, high);
+        scale = target - below < above - target ? low : high;
+        for (size_t i = 0; i < texels; i++)
+        {
+            unsigned char& alpha = level.pixels[i * channels + alphaChannel];
+            alpha = scaledAlpha(alpha, scale);
+        }
+    }
+};
+
+// levels 1 and down of a tightly packed 8 bit image
+inline std::vector<MipLevel> BuildMipChain(const unsigned char* pixels, int width, int height, int channels,
+                                           const MipmapOptions& options = MipmapOptions{})
+{
+    MipChainBuilder builder(channels, options);
+    return builder.build(pixels, width, height);
+}
+
+#endif
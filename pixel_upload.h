@@ -0,0 +1,200 @@
+#ifndef PIXEL_UPLOAD_H
+#define PIXEL_UPLOAD_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+
+// A region of the pixel upload buffer. Any thread may write the pixels through data, the
+// reserve/upload calls themselves belong to the GL thread.
+struct PixelUploadRegion
+{
+    unsigned char* data = nullptr; // nullptr when nothing could be reserved this time
+    size_t offset = 0;
+    size_t size = 0;
+    bool valid() const { return data != nullptr; }
+};
+
+// Ring of pixel unpack memory. Texel data is written into a reserved region (typically by a
+// worker, so the copy never touches the GL thread) and glTexSubImage2D then sources it from the
+// buffer, which lets the driver do the transfer asynchronously instead of copying out of client
+// memory before the call returns. Each uploaded region is fenced and only reused once the GPU
+// has consumed it.
+//
+// GL 4.4 maps the buffer once, persistent and coherent, and any number of regions can be
+// outstanding. On GL 3.3 each region is its own unsynchronized mapping, so only one region at
+// a time can be waiting to be filled.
+class PixelUploadBuffer
+{
+public:
+    explicit PixelUploadBuffer(size_t capacity = 32 << 20)
+        : capacity(capacity)
+    {
+        persistent = GLAD_GL_VERSION_4_4 != 0;
+        glGenBuffers(1, &id);
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+        if (persistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, flags);
+            mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, capacity, flags));
+            if (!mapped)
+            {
+                std::cout << "ERROR::PIXEL_UPLOAD::PERSISTENT_MAP_FAILED" << std::endl;
+            }
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+        }
+        // a bound unpack buffer turns every client pointer into an offset, never leave it bound
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    ~PixelUploadBuffer()
+    {
+        for (auto& region : regions)
+            if (region.fence)
+                glDeleteSync(region.fence);
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+        if (mapped || mappedRegion)
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glState.deleteBuffer(id);
+    }
+
+    PixelUploadBuffer(const PixelUploadBuffer&) = delete;
+    PixelUploadBuffer& operator=(const PixelUploadBuffer&) = delete;
+
+    // get size bytes to fill. Waits for the GPU if the ring has to wrap onto regions it is still
+    // reading, returns an invalid region if the space is held by regions not uploaded yet.
+    PixelUploadRegion reserve(size_t size)
+    {
+        if (size > capacity || (!persistent && mappedRegion))
+            return PixelUploadRegion{};
+        size_t start = head;
+        if (start + size > capacity)
+            start = 0;
+        if (!release(start, size))
+            return PixelUploadRegion{};
+
+        PixelUploadRegion region;
+        region.offset = start;
+        region.size = size;
+        if (persistent)
+        {
+            region.data = mapped ? mapped + start : nullptr;
+        }
+        else
+        {
+            glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+            // the fences already make sure the GPU is done with this range
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+            region.data = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, start, size, flags));
+            glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            mappedRegion = region.data != nullptr;
+        }
+        if (!region.valid())
+            return PixelUploadRegion{};
+        head = start + size;
+        regions.push_back(Region{ start, size, nullptr });
+        return region;
+    }
+
+    // glTexSubImage2D out of a filled region into the texture bound for update. rowLength is the
+    // pitch of the pixels in the region in texels, 0 for tightly packed rows.
+    void upload(const PixelUploadRegion& region, GLenum target, GLint level, GLint x, GLint y,
+                GLsizei width, GLsizei height, GLenum format, GLenum type, GLint rowLength = 0)
+    {
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, id);
+        if (!persistent && mappedRegion)
+        {
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            mappedRegion = false;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+        glTexSubImage2D(target, level, x, y, width, height, format, type, (void*)(uintptr_t)region.offset);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glState.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        for (auto& pending : regions)
+        {
+            if (pending.offset == region.offset && !pending.fence)
+            {
+                pending.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+                break;
+            }
+        }
+    }
+
+    size_t size() const { return capacity; }
+    bool isPersistent() const { return persistent; }
+    // times reserve() had to block on the GPU
+    uint32_t stallCount() const { return stalls; }
+
+private:
+    struct Region
+    {
+        size_t offset;
+        size_t size;
+        GLsync fence; // nullptr until the region is uploaded
+    };
+
+    GLuint id = 0;
+    size_t capacity;
+    size_t head = 0;
+    bool persistent = false;
+    bool mappedRegion = false;
+    unsigned char* mapped = nullptr;
+    // reserved regions in the order they were handed out, which is also the order the ring
+    // sweeps over them
+    std::deque<Region> regions;
+    uint32_t stalls = 0;
+
+    static bool overlaps(const Region& region, size_t start, size_t size)
+    {
+        return region.offset < start + size && start < region.offset + region.size;
+    }
+
+    // retire every region in the way of [start, start + size), oldest first
+    bool release(size_t start, size_t size)
+    {
+        size_t last = 0;
+        bool any = false;
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            if (overlaps(regions[i], start, size))
+            {
+                last = i;
+                any = true;
+            }
+        }
+        if (!any)
+            return true;
+        for (size_t i = 0; i <= last; i++)
+            if (!regions[i].fence)
+                return false;
+        for (size_t i = 0; i <= last; i++)
+        {
+            GLsync fence = regions.front().fence;
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+                stalls++;
+                while (result == GL_TIMEOUT_EXPIRED)
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            }
+            glDeleteSync(fence);
+            regions.pop_front();
+        }
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+
+// On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary).
+// Entries are keyed by the shader sources and the driver strings, so a driver update or an
+// edited shader simply misses the cache, and a binary the driver rejects falls back to compiling.
+
+// where the binaries are written, relative to the working directory
+inline std::string programCacheDirectory = "shader_cache";
+
+struct ProgramBinaryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+constexpr uint32_t PROGRAM_BINARY_MAGIC = 0x4E424750; // "PGBN"
+constexpr uint32_t PROGRAM_BINARY_VERSION = 1;
+
+// 64 bit FNV-1a, chained through seed so several strings can go into one key
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ull)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t HashString(const char* text, uint64_t seed)
+{
+    // include the terminator so "ab"+"c" and "a"+"bc" hash differently
+    return HashBytes(text, text ? std::char_traits<char>::length(text) + 1 : 0, seed);
+}
+
+// Key for a program built from the given stage sources on the current context's driver.
+inline uint64_t ProgramCacheKey(const std::string& vertexCode, const std::string& fragmentCode)
+{
+    uint64_t key = HashString(vertexCode.c_str(), 14695981039346656037ull);
+    key = HashString(fragmentCode.c_str(), key);
+    key = HashString(reinterpret_cast<const char*>(glGetString(GL_VENDOR)), key);
+    key = HashString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)), key);
+    key = HashString(reinterpret_cast<const char*>(glGetString(GL_VERSION)), key);
+    return key;
+}
+
+inline std::filesystem::path ProgramCachePath(uint64_t key)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return std::filesystem::path(programCacheDirectory) / name;
+}
+
+// Returns true if the driver can hand out program binaries at all: they need GL 4.1 (glad has no
+// extension loaders, so ARB_get_program_binary alone doesn't count), and some drivers report zero formats.
+inline bool ProgramBinarySupported()
+{
+    if (!GLAD_GL_VERSION_4_1)
+        return false;
+    int formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+// Try to load a cached binary into program. Returns false on a miss or if the driver rejected
+// the binary, in which case the caller compiles from source (and the stale entry gets overwritten).
+inline bool LoadProgramBinary(unsigned int program, uint64_t key)
+{
+    if (!ProgramBinarySupported())
+        return false;
+    std::ifstream file(ProgramCachePath(key), std::ios::binary);
+    if (!file)
+        return false;
+
+    ProgramBinaryHeader header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || header.magic != PROGRAM_BINARY_MAGIC || header.version != PROGRAM_BINARY_VERSION || header.key != key)
+        return false;
+
+    std::vector<char> binary(header.length);
+    file.read(binary.data(), header.length);
+    if (!file)
+        return false;
+
+    glProgramBinary(program, header.format, binary.data(), (GLsizei)header.length);
+    int success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success != 0;
+}
+
+// Write the binary of a successfully linked program. The program must have been linked with
+// GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+inline void SaveProgramBinary(unsigned int program, uint64_t key)
+{
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+
+    std::error_code error;
+    std::filesystem::create_directories(programCacheDirectory, error);
+    // write next to the final name and rename, so a crash never leaves a truncated entry behind
+    const auto path = ProgramCachePath(key);
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::CACHE::WRITE_FAILED " << temporary.string() << std::endl;
+            return;
+        }
+        const ProgramBinaryHeader header{ PROGRAM_BINARY_MAGIC, PROGRAM_BINARY_VERSION, key, format, (uint32_t)length };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(binary.data(), length);
+    }
+    std::filesystem::rename(temporary, path, error);
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+#include "frame_arena.h"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// Everything needed to issue one indexed draw. Plain data so a frame's worth of packets can
+// live in a FrameArena and be thrown away with it.
+struct DrawPacket
+{
+    static constexpr int MAX_TEXTURES = 4;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint textures[MAX_TEXTURES]; // bound to units 0..textureCount-1
+    uint32_t textureCount;
+    uint32_t indexCount;
+    uint32_t firstIndex;           // in indices, GL_UNSIGNED_INT
+    int modelLocation;             // location of the model matrix uniform, -1 to skip it
+    float model[16];               // column major, like Eigen::Matrix4f::data()
+};
+static_assert(std::is_trivially_copyable<DrawPacket>::value, "draw packets are copied around as raw memory");
+
+// The sort key orders draws by what is most expensive to change:
+//   63..52 program | 51..36 texture set | 35..24 vertex array | 23..0 depth (front to back)
+// GL names are folded into their fields, a collision only costs an extra state change.
+inline uint64_t MakeSortKey(const DrawPacket& packet, float depth)
+{
+    uint32_t textureSet = 2166136261u;
+    for (uint32_t i = 0; i < packet.textureCount; i++)
+    {
+        textureSet ^= packet.textures[i];
+        textureSet *= 16777619u;
+    }
+    textureSet = (textureSet ^ (textureSet >> 16)) & 0xFFFF;
+
+    depth = depth < 0.f ? 0.f : (depth > 1.f ? 1.f : depth);
+    const uint64_t depthBits = (uint64_t)(depth * (float)0xFFFFFF);
+    return ((uint64_t)(packet.program & 0xFFF) << 52)
+        | ((uint64_t)textureSet << 36)
+        | ((uint64_t)(packet.vertexArray & 0xFFF) << 24)
+        | depthBits;
+}
+
+struct SortEntry
+{
+    uint64_t key;
+    const DrawPacket* packet;
+};
+
+// LSD radix sort on the 64 bit keys, one byte per pass. All eight histograms come out of one
+// read of the input, and passes where every key has the same byte are skipped, which with
+// few programs and VAOs is most of them. scratch must hold count entries. Stable.
+inline void RadixSortEntries(SortEntry* entries, SortEntry* scratch, size_t count)
+{
+    if (count < 2)
+        return;
+    uint32_t histograms[8][256] = {};
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint64_t key = entries[i].key;
+        for (int pass = 0; pass < 8; pass++)
+            histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+    }
+
+    SortEntry* source = entries;
+    SortEntry* destination = scratch;
+    for (int pass = 0; pass < 8; pass++)
+    {
+        uint32_t* histogram = histograms[pass];
+        const int shift = pass * 8;
+        if (histogram[(source[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        uint32_t offset = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            const uint32_t bucket = histogram[digit];
+            histogram[digit] = offset;
+            offset += bucket;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            const SortEntry entry = source[i];
+            destination[histogram[(entry.key >> shift) & 0xFF]++] = entry;
+        }
+        SortEntry* swap = source;
+        source = destination;
+        destination = swap;
+    }
+    if (source != entries)
+        memcpy(entries, source, count * sizeof(SortEntry));
+}
+
+// Collects the frame's draws, sorts them by state and issues them through glState.
+// Call reset() at the start of every frame.
+class RenderQueue
+{
+public:
+    explicit RenderQueue(size_t arenaBlockSize = 4 << 20)
+        : arena(arenaBlockSize)
+    {
+    }
+
+    void reset()
+    {
+        arena.reset();
+        entries.clear();
+    }
+
+    // depth is the normalized view distance, 0 at the near plane and 1 at the far plane
+    void submit(const DrawPacket& packet, float depth)
+    {
+        DrawPacket* stored = arena.allocate<DrawPacket>();
+        *stored = packet;
+        entries.push_back(SortEntry{ MakeSortKey(packet, depth), stored });
+    }
+
+    void sort()
+    {
+        scratch.resize(entries.size());
+        RadixSortEntries(entries.data(), scratch.data(), entries.size());
+    }
+
+    // sort and draw everything submitted this frame
+    void execute()
+    {
+        sort();
+        for (const SortEntry& entry : entries)
+        {
+            const DrawPacket& packet = *entry.packet;
+            glState.useProgram(packet.program);
+            for (uint32_t unit = 0; unit < packet.textureCount; unit++)
+                glState.bindTexture(unit, GL_TEXTURE_2D, packet.textures[unit]);
+            glState.bindVertexArray(packet.vertexArray);
+            if (packet.modelLocation >= 0)
+                glUniformMatrix4fv(packet.modelLocation, 1, GL_FALSE, packet.model);
+            glDrawElements(GL_TRIANGLES, (GLsizei)packet.indexCount, GL_UNSIGNED_INT,
+                           (void*)(uintptr_t)(packet.firstIndex * sizeof(GLuint)));
+        }
+    }
+
+    size_t size() const { return entries.size(); }
+    const std::vector<SortEntry>& sorted() const { return entries; }
+
+private:
+    FrameArena arena;
+    // the sort buffers keep their capacity between frames, so a steady scene never allocates
+    std::vector<SortEntry> entries;
+    std::vector<SortEntry> scratch;
+};
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef SCENE_DEPTH_H
+#define SCENE_DEPTH_H
+
+#include <glad/glad.h>
+#include <Eigen/Dense>
+#include "utils.h"
+
+#include <iostream>
+
+// How the scene stores depth, picked at startup (--reversed-z, --infinite-far).
+struct DepthMode
+{
+    // depth 1 at the near plane and 0 at the far plane, into a float depth buffer
+    bool reversedZ = false;
+    // no far plane, nothing is clipped for being too far away
+    bool infiniteFar = false;
+};
+
+// The depth setup for a DepthMode: projection, depth test and where the scene renders to.
+//
+// Standard depth renders straight to the window with GL_LESS. Reversed-Z needs a [0,1] clip
+// depth range (glClipControl, GL 4.5) and a float depth buffer, which the default framebuffer
+// doesn't offer, so the scene renders into a framebuffer with a GL_DEPTH_COMPONENT32F depth
+// buffer, tests with GL_GREATER, clears depth to 0 and is blitted to the window at the end of
+// the frame. Without glClipControl reversed-Z falls back to standard depth.
+class SceneDepth
+{
+public:
+    SceneDepth(const DepthMode& requested, int width, int height)
+        : depthMode(requested)
+    {
+        if (depthMode.reversedZ && !GLAD_GL_VERSION_4_5)
+        {
+            std::cout << "ERROR::SCENE_DEPTH::NO_CLIP_CONTROL reversed-Z needs GL 4.5, using standard depth" << std::endl;
+            depthMode.reversedZ = false;
+        }
+        if (depthMode.reversedZ)
+        {
+            glGenFramebuffers(1, &framebuffer);
+            glGenRenderbuffers(1, &colorBuffer);
+            glGenRenderbuffers(1, &depthBuffer);
+            resize(width, height);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+            const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            if (!complete)
+            {
+                std::cout << "ERROR::SCENE_DEPTH::FRAMEBUFFER_INCOMPLETE using standard depth" << std::endl;
+                release();
+                depthMode.reversedZ = false;
+            }
+        }
+        if (depthMode.reversedZ)
+            glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glDepthFunc(depthFunction());
+        glClearDepth(depthMode.reversedZ ? 0.0 : 1.0);
+    }
+
+    ~SceneDepth()
+    {
+        if (depthMode.reversedZ)
+        {
+            glClipControl(GL_LOWER_LEFT, GL_NEGATIVE_ONE_TO_ONE);
+            glDepthFunc(GL_LESS);
+            glClearDepth(1.0);
+        }
+        release();
+    }
+
+    SceneDepth(const SceneDepth&) = delete;
+    SceneDepth& operator=(const SceneDepth&) = delete;
+
+    // the window's framebuffer size changed
+    void resize(int width, int height)
+    {
+        targetWidth = width;
+        targetHeight = height;
+        if (!framebuffer)
+            return;
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    }
+
+    // before clearing, everything up to endFrame() renders into the scene target
+    void beginFrame()
+    {
+        if (framebuffer)
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+
+    // before swapping, copies the scene to the window when it went through the framebuffer
+    void endFrame()
+    {
+        if (!framebuffer)
+            return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, targetWidth, targetHeight, 0, 0, targetWidth, targetHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    Eigen::Matrix4f projection(float fovY, float aspect, float near, float far) const
+    {
+        if (depthMode.reversedZ)
+            return depthMode.infiniteFar ? GetMatPerspectiveProjectionReversedInfinite(fovY, aspect, near)
+                                         : GetMatPerspectiveProjectionReversed(fovY, aspect, near, far);
+        return depthMode.infiniteFar ? GetMatPerspectiveProjectionInfinite(fovY, aspect, near)
+                                     : GetMatPerspectiveProjection(fovY, aspect, near, far);
+    }
+
+    GLenum depthFunction() const { return depthMode.reversedZ ? GL_GREATER : GL_LESS; }
+    // clip space depth runs 0..w instead of -w..w, see ExtractFrustum
+    bool zeroToOneDepth() const { return depthMode.reversedZ; }
+    // what is in effect, which may be less than was asked for
+    const DepthMode& mode() const { return depthMode; }
+
+private:
+    DepthMode depthMode;
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+    int targetWidth = 0;
+    int targetHeight = 0;
+
+    void release()
+    {
+        if (framebuffer)
+            glDeleteFramebuffers(1, &framebuffer);
+        if (colorBuffer)
+            glDeleteRenderbuffers(1, &colorBuffer);
+        if (depthBuffer)
+            glDeleteRenderbuffers(1, &depthBuffer);
+        framebuffer = colorBuffer = depthBuffer = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <Eigen/Dense>
+#include "job_system.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A hierarchy of nodes with local translation, rotation and scale. The nodes live in flat
+// arrays sorted depth first, so every subtree is one contiguous run of slots that starts at
+// its root and every parent comes before its children. Changing a node marks it dirty;
+// update() recomputes the world matrices of the dirty subtrees only, the subtrees spread over
+// the job system's threads, and leaves everything else as it was.
+//
+// Nodes are named by the id add() returns, which stays the same when the arrays are re-sorted.
+class SceneGraph
+{
+public:
+    static constexpr uint32_t NO_PARENT = 0xFFFFFFFFu;
+
+    // a node under parent (NO_PARENT for a root). Its world matrix is valid after the next update.
+    uint32_t add(uint32_t parent, const Eigen::Vector3f& position = Eigen::Vector3f::Zero(),
+                 const Eigen::Quaternionf& rotation = Eigen::Quaternionf::Identity(),
+                 const Eigen::Vector3f& scale = Eigen::Vector3f::Ones())
+    {
+        const uint32_t id = (uint32_t)slotOf.size();
+        const uint32_t slot = (uint32_t)idOf.size();
+        slotOf.push_back(slot);
+        idOf.push_back(id);
+        // appended after the parent's subtree, update() restores the depth first order
+        parents.push_back(parent == NO_PARENT ? NO_PARENT : slotOf[parent]);
+        positions.push_back(position);
+        rotations.push_back(rotation);
+        scales.push_back(scale);
+        worlds.push_back(Eigen::Matrix4f::Identity());
+        subtreeEnds.push_back(slot + 1);
+        dirty.push_back(0);
+        layoutChanged = true;
+        return id;
+    }
+
+    void setLocal(uint32_t id, const Eigen::Vector3f& position, const Eigen::Quaternionf& rotation, const Eigen::Vector3f& scale)
+    {
+        const uint32_t slot = slotOf[id];
+        positions[slot] = position;
+        rotations[slot] = rotation;
+        scales[slot] = scale;
+        markDirty(slot);
+    }
+    void setPosition(uint32_t id, const Eigen::Vector3f& position)
+    {
+        positions[slotOf[id]] = position;
+        markDirty(slotOf[id]);
+    }
+    void setRotation(uint32_t id, const Eigen::Quaternionf& rotation)
+    {
+        rotations[slotOf[id]] = rotation;
+        markDirty(slotOf[id]);
+    }
+
+    // the whole graph is recomputed by the next update
+    void invalidate()
+    {
+        for (uint32_t slot = 0; slot < parents.size(); slot++)
+            if (parents[slot] == NO_PARENT)
+                markDirty(slot);
+    }
+
+    // recompute the world matrices below every node changed since the last update
+    void update(JobSystem& jobs)
+    {
+        if (layoutChanged)
+            sortDepthFirst();
+        updated = 0;
+        if (dirtySlots.empty())
+            return;
+
+        // sorted, a dirty node inside an earlier dirty subtree is already covered by it
+        std::sort(dirtySlots.begin(), dirtySlots.end());
+        ranges.clear();
+        uint32_t coveredEnd = 0;
+        for (uint32_t slot : dirtySlots)
+        {
+            dirty[slot] = 0;
+            if (slot < coveredEnd)
+                continue;
+            ranges.push_back(Range{ slot, subtreeEnds[slot] });
+            coveredEnd = subtreeEnds[slot];
+            updated += coveredEnd - slot;
+        }
+        dirtySlots.clear();
+
+        // the subtrees are independent, so they go to the workers in batches of about
+        // BATCH_NODES nodes, small subtrees grouped together
+        batchStarts.clear();
+        size_t batchNodes = BATCH_NODES;
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            if (batchNodes >= BATCH_NODES)
+            {
+                batchStarts.push_back(i);
+                batchNodes = 0;
+            }
+            batchNodes += ranges[i].end - ranges[i].begin;
+        }
+        batchStarts.push_back(ranges.size());
+        jobs.parallelFor(batchStarts.size() - 1, 1, [this](size_t first, size_t last)
+        {
+            for (size_t i = batchStarts[first]; i < batchStarts[last]; i++)
+                updateRange(ranges[i].begin, ranges[i].end);
+        });
+    }
+
+    const Eigen::Matrix4f& world(uint32_t id) const { return worlds[slotOf[id]]; }
+    size_t size() const { return parents.size(); }
+    // world matrices the last update recomputed
+    size_t lastUpdated() const { return updated; }
+
+private:
+    static constexpr size_t BATCH_NODES = 2048;
+
+    struct Range
+    {
+        uint32_t begin, end;
+    };
+
+    // by slot, in depth first order once sorted
+    std::vector<uint32_t> parents;     // slot of the parent, NO_PARENT for roots
+    std::vector<uint32_t> subtreeEnds; // one past the last slot of the node's subtree
+    std::vector<Eigen::Vector3f> positions;
+    std::vector<Eigen::Quaternionf> rotations;
+    std::vector<Eigen::Vector3f> scales;
+    std::vector<Eigen::Matrix4f> worlds;
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> idOf;
+
+    std::vector<uint32_t> slotOf; // by id
+    std::vector<uint32_t> dirtySlots;
+    std::vector<Range> ranges;
+    std::vector<size_t> batchStarts;
+    bool layoutChanged = false;
+    size_t updated = 0;
+
+    void markDirty(uint32_t slot)
+    {
+        if (dirty[slot])
+            return;
+        dirty[slot] = 1;
+        dirtySlots.push_back(slot);
+    }
+
+    // parents come first in the range, so each node finds its parent's world already done
+    void updateRange(uint32_t begin, uint32_t end)
+    {
+        for (uint32_t slot = begin; slot < end; slot++)
+        {
+            Eigen::Matrix4f local = Eigen::Matrix4f::Identity();
+            local.block<3, 3>(0, 0) = rotations[slot].toRotationMatrix() * scales[slot].asDiagonal();
+            local.block<3, 1>(0, 3) = positions[slot];
+            worlds[slot] = parents[slot] == NO_PARENT ? local : Eigen::Matrix4f(worlds[parents[slot]] * local);
+        }
+    }
+
+    // Put the nodes back in depth first order after adds: roots in slot order, each followed by
+    // its subtree, children in slot order too. Everything is recomputed afterwards.
+    void sortDepthFirst()
+    {
+        const uint32_t count = (uint32_t)parents.size();
+        // children of each slot, packed by parent
+        std::vector<uint32_t> childStart(count + 1, 0), children(count);
+        for (uint32_t slot = 0; slot < count; slot++)
+            if (parents[slot] != NO_PARENT)
+                childStart[parents[slot] + 1]++;
+        for (uint32_t slot = 0; slot < count; slot++)
+            childStart[slot + 1] += childStart[slot];
+        std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+        for (uint32_t slot = 0; slot < count; slot++)
+            if (parents[slot] != NO_PARENT)
+                children[fill[parents[slot]]++] = slot;
+
+        std::vector<uint32_t> order;
+        order.reserve(count);
+        std::vector<uint32_t> stack;
+        for (uint32_t root = 0; root < count; root++)
+        {
+            if (parents[root] != NO_PARENT)
+                continue;
+            stack.push_back(root);
+            while (!stack.empty())
+            {
+                const uint32_t slot = stack.back();
+                stack.pop_back();
+                order.push_back(slot);
+                for (uint32_t i = childStart[slot + 1]; i > childStart[slot]; i--)
+                    stack.push_back(children[i - 1]);
+            }
+        }
+
+        std::vector<uint32_t> newSlot(count);
+        for (uint32_t i = 0; i < count; i++)
+            newSlot[order[i]] = i;
+        auto permute = [&order](auto& values)
+        {
+            auto sorted = values;
+            for (size_t i = 0; i < order.size(); i++)
+                sorted[i] = values[order[i]];
+            values.swap(sorted);
+        };
+        permute(positions);
+        permute(rotations);
+        permute(scales);
+        permute(idOf);
+        std::vector<uint32_t> sortedParents(count);
+        for (uint32_t i = 0; i < count; i++)
+            sortedParents[i] = parents[order[i]] == NO_PARENT ? NO_PARENT : newSlot[parents[order[i]]];
+        parents.swap(sortedParents);
+        for (uint32_t i = 0; i < count; i++)
+            slotOf[idOf[i]] = i;
+
+        // subtree sizes from the leaves up, children always sit after their parent
+        std::vector<uint32_t> sizes(count, 1);
+        for (uint32_t slot = count; slot-- > 0;)
+            if (parents[slot] != NO_PARENT)
+                sizes[parents[slot]] += sizes[slot];
+        for (uint32_t slot = 0; slot < count; slot++)
+            subtreeEnds[slot] = slot + sizes[slot];
+
+        std::fill(dirty.begin(), dirty.end(), 0);
+        dirtySlots.clear();
+        layoutChanged = false;
+        invalidate();
+    }
+};
+
+#endif
@@ -4,11 +4,34 @@
 
 #include <glad/glad.h> // include glad to get all the required OpenGL headers
 #include <Eigen/Dense>
+#include "program_cache.h"
+#include "gl_state.h"
+#include "frame_constants.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <cstdint>
+#include <chrono>
+
+
+// A resolved uniform location. Look it up once with Shader::getUniform and keep it around,
+// setting through a handle skips the name lookup entirely.
+struct UniformHandle
+{
+    int location = -1;
+    bool valid() const { return location >= 0; }
+};
+
+
+// tag for the constructor that only submits the compile and link, see ShaderLibrary
+struct DeferLink {};
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 
 class Shader
@@ -16,10 +39,25 @@ class Shader
 public:
     // the program ID
     unsigned int ID;
+    // true when the program came out of the binary cache instead of being compiled
+    bool fromCache = false;
+    // time spent issuing the compile/link calls, and time blocked on their status afterwards
+    double submitMilliseconds = 0.0;
+    mutable double waitMilliseconds = 0.0;
 
     // constructor reads and builds the shader
     Shader(const char* vertexPath, const char* fragmentPath)
+        : Shader(vertexPath, fragmentPath, DeferLink{})
+    {
+        resolve();
+    }
+
+    // reads the sources and hands the compile and link to the driver without asking for their
+    // status, so several programs can be in flight at once. The status is checked by resolve(),
+    // which use() and getUniform() call on first use.
+    Shader(const char* vertexPath, const char* fragmentPath, DeferLink)
     {
+        const auto start = std::chrono::steady_clock::now();
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -48,17 +86,66 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        expandFrameConstants(vertexCode);
+        expandFrameConstants(fragmentCode);
+        // 2. a cached binary from an earlier run skips compiling altogether
+        ID = glCreateProgram();
+        cacheKey = ProgramCacheKey(vertexCode, fragmentCode);
+        if (LoadProgramBinary(ID, cacheKey))
+        {
+            fromCache = true;
+            reflectUniforms();
+            bindUniformBlocks();
+            submitMilliseconds = elapsedMilliseconds(start);
+            return;
+        }
+
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        int success;
-        char infoLog[512];
-
+        // 3. compile shaders
         // vertex Shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
         glShaderSource(vertex, 1, &vShaderCode, NULL);
         glCompileShader(vertex);
+
+        // fragmetn Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glCompileShader(fragment);
+
+        // shader Program
+        glAttachShader(ID, vertex);
+        glAttachShader(ID, fragment);
+        if (ProgramBinarySupported())
+            glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(ID);
+        pending = true;
+        submitMilliseconds = elapsedMilliseconds(start);
+    }
+
+    // non blocking check whether the driver has finished the link. Without
+    // KHR_parallel_shader_compile this can only answer by blocking, so it reports true and
+    // leaves the wait to resolve().
+    bool ready(bool parallelCompile) const
+    {
+        if (!pending || !parallelCompile)
+            return true;
+        int done = 0;
+        glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &done);
+        return done != 0;
+    }
+
+    // wait for the compile and link, print any errors and build the uniform table.
+    // Does nothing once the program is resolved.
+    void resolve() const
+    {
+        if (!pending)
+            return;
+        pending = false;
+        const auto start = std::chrono::steady_clock::now();
+        int success;
+        char infoLog[512];
+
         // print compile errors if any
         glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
         if (!success)
@@ -66,12 +153,6 @@ public:
             glGetShaderInfoLog(vertex, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
         };
-
-        // fragmetn Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        // print compile errors if any
         glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
         if (!success)
         {
@@ -79,11 +160,6 @@ public:
             std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
         };
 
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
         // print linking errors if any
         glGetProgramiv(ID, GL_LINK_STATUS, &success);
         if (!success)
@@ -91,39 +167,189 @@ public:
             glGetProgramInfoLog(ID, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
         }
+        else if (ProgramBinarySupported())
+        {
+            SaveProgramBinary(ID, cacheKey);
+        }
 
         // delete the shaders as they're linked into our program now and no longer necessary
+        glDetachShader(ID, vertex);
+        glDetachShader(ID, fragment);
         glDeleteShader(vertex);
         glDeleteShader(fragment);
 
+        reflectUniforms();
+        bindUniformBlocks();
+        waitMilliseconds = elapsedMilliseconds(start);
     }
     // use/activate the shader
     void use()
     {
-        glUseProgram(ID);
+        resolve();
+        glState.useProgram(ID);
+    }
+    // resolve a uniform name against the table built at link time. Returns an invalid handle
+    // for names the linker optimized away, setting through it is a no-op just like location -1.
+    UniformHandle getUniform(const char* name) const
+    {
+        resolve();
+        const uint32_t hash = hashName(name);
+        const uint32_t mask = (uint32_t)uniformSlots.size() - 1;
+        for (uint32_t i = hash & mask; uniformSlots[i] >= 0; i = (i + 1) & mask)
+        {
+            const UniformEntry& entry = uniforms[uniformSlots[i]];
+            if (entry.hash == hash && entry.name == name)
+                return UniformHandle{ entry.location };
+        }
+        return UniformHandle{};
     }
     // utility uniform functions
-    void setBool(const std::string& name, bool value) const
+    void setBool(const char* name, bool value) const
+    {
+        setBool(getUniform(name), value);
+    }
+    void setInt(const char* name, int value) const
+    {
+        setInt(getUniform(name), value);
+    }
+    void setFloat(const char* name, float value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        setFloat(getUniform(name), value);
     }
-    void setInt(const std::string& name, int value) const
+    void setFloat4(const char* name, float val_0, float val_1, float val_2, float val_3) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        setFloat4(getUniform(name), val_0, val_1, val_2, val_3);
     }
-    void setFloat(const std::string& name, float value) const
+    void setMat4f(const char* name, const Eigen::Matrix4f& mat) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        setMat4f(getUniform(name), mat);
     }
-    void setFloat4(const std::string& name, float val_0, float val_1, float val_2, float val_3) const
+    // the same setters for handles resolved up front
+    void setBool(UniformHandle handle, bool value) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), val_0, val_1, val_2, val_3);
+        glUniform1i(handle.location, (int)value);
     }
-    void setMat4f(const std::string& name, Eigen::Matrix4f mat)
+    void setInt(UniformHandle handle, int value) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, mat.data());
+        glUniform1i(handle.location, value);
+    }
+    void setFloat(UniformHandle handle, float value) const
+    {
+        glUniform1f(handle.location, value);
+    }
+    void setFloat4(UniformHandle handle, float val_0, float val_1, float val_2, float val_3) const
+    {
+        glUniform4f(handle.location, val_0, val_1, val_2, val_3);
+    }
+    void setMat4f(UniformHandle handle, const Eigen::Matrix4f& mat) const
+    {
+        glUniformMatrix4fv(handle.location, 1, GL_FALSE, mat.data());
     }
 
+private:
+    // state of a submitted but not yet resolved link. resolve() is const because finishing the
+    // link lazily does not change what the program is, only whether we have looked at it yet.
+    mutable bool pending = false;
+    unsigned int vertex = 0, fragment = 0;
+    uint64_t cacheKey = 0;
+
+    struct UniformEntry
+    {
+        uint32_t hash;
+        int location;
+        std::string name;
+    };
+    // every active uniform, plus an open addressed index into it (-1 marks an empty slot)
+    mutable std::vector<UniformEntry> uniforms;
+    mutable std::vector<int> uniformSlots;
+
+    static double elapsedMilliseconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // FNV-1a, good enough for a few dozen short identifiers
+    static uint32_t hashName(const char* name)
+    {
+        uint32_t hash = 2166136261u;
+        for (; *name; ++name)
+        {
+            hash ^= (unsigned char)*name;
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    void addUniform(const std::string& name, int location) const
+    {
+        uniforms.push_back(UniformEntry{ hashName(name.c_str()), location, name });
+    }
+
+    // swap the frame_constants pragma for the block definition, stages without it are left alone
+    static void expandFrameConstants(std::string& code)
+    {
+        const auto at = code.find(FRAME_CONSTANTS_PRAGMA);
+        if (at == std::string::npos)
+            return;
+        const auto end = code.find('\n', at);
+        code.replace(at, end == std::string::npos ? std::string::npos : end + 1 - at, FRAME_CONSTANTS_GLSL);
+    }
+
+    // point the shared blocks at their fixed binding points
+    void bindUniformBlocks() const
+    {
+        const GLuint frameConstants = glGetUniformBlockIndex(ID, FRAME_CONSTANTS_BLOCK);
+        if (frameConstants != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, frameConstants, FRAME_CONSTANTS_BINDING);
+    }
+
+    // walk the active uniforms once after linking so the setters never have to ask the driver
+    void reflectUniforms() const
+    {
+        uniforms.clear();
+        int count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> buffer(maxLength > 0 ? maxLength : 1);
+        for (int i = 0; i < count; i++)
+        {
+            int length = 0, size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, maxLength, &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            const int location = glGetUniformLocation(ID, name.c_str());
+            // members of uniform blocks have no location
+            if (location < 0)
+                continue;
+            addUniform(name, location);
+            // arrays are reported as "name[0]", register the bare name and every element too
+            const auto bracket = name.find('[');
+            if (bracket != std::string::npos)
+            {
+                const std::string base = name.substr(0, bracket);
+                addUniform(base, location);
+                for (int element = 1; element < size; element++)
+                {
+                    const std::string elementName = base + "[" + std::to_string(element) + "]";
+                    addUniform(elementName, glGetUniformLocation(ID, elementName.c_str()));
+                }
+            }
+        }
+
+        // keep the table at most half full so probes stay short
+        size_t slotCount = 16;
+        while (slotCount < uniforms.size() * 2)
+            slotCount *= 2;
+        uniformSlots.assign(slotCount, -1);
+        const uint32_t mask = (uint32_t)slotCount - 1;
+        for (int index = 0; index < (int)uniforms.size(); index++)
+        {
+            uint32_t slot = uniforms[index].hash & mask;
+            while (uniformSlots[slot] >= 0)
+                slot = (slot + 1) & mask;
+            uniformSlots[slot] = index;
+        }
+    }
 };
 
 
@@ -0,0 +1,111 @@
+#ifndef SHADER_LIBRARY_H
+#define SHADER_LIBRARY_H
+
+#include "shader.h"
+#include "gl_extensions.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+typedef void (APIENTRYP PFN_MAX_SHADER_COMPILER_THREADS)(GLuint count);
+
+// Builds a batch of programs together. add() only submits the compile and link, the status
+// queries happen when a program is first used, so the driver can work on all of them at once.
+// With KHR_parallel_shader_compile (or the ARB version) the driver compiles on its own threads
+// and ready()/allReady() can be polled without blocking.
+class ShaderLibrary
+{
+public:
+    // loader is only needed to reach glMaxShaderCompilerThreadsKHR, which glad does not load
+    explicit ShaderLibrary(GLADloadproc loader = nullptr)
+    {
+        const bool khr = HasGLExtension("GL_KHR_parallel_shader_compile");
+        parallelCompile = khr || HasGLExtension("GL_ARB_parallel_shader_compile");
+        if (parallelCompile && loader)
+        {
+            auto maxThreads = (PFN_MAX_SHADER_COMPILER_THREADS)loader(khr ? "glMaxShaderCompilerThreadsKHR" : "glMaxShaderCompilerThreadsARB");
+            // 0xFFFFFFFF lets the driver use as many threads as it likes
+            if (maxThreads)
+                maxThreads(0xFFFFFFFFu);
+        }
+    }
+
+    // submit a program, the returned shader resolves itself on first use
+    Shader& add(const std::string& name, const char* vertexPath, const char* fragmentPath)
+    {
+        if (entries.empty())
+            batchStart = std::chrono::steady_clock::now();
+        entries.push_back(Entry{ name, std::make_unique<Shader>(vertexPath, fragmentPath, DeferLink{}) });
+        return *entries.back().shader;
+    }
+
+    // look a program up by name, waiting for its link if it is still in flight.
+    // nullptr, with an error, for a name that was never added.
+    Shader* get(const std::string& name)
+    {
+        for (auto& entry : entries)
+        {
+            if (entry.name == name)
+            {
+                entry.shader->resolve();
+                return entry.shader.get();
+            }
+        }
+        std::cout << "ERROR::SHADER_LIBRARY::UNKNOWN_PROGRAM " << name << std::endl;
+        return nullptr;
+    }
+
+    // true once the driver reports every program finished, never blocks with parallel compile
+    bool allReady() const
+    {
+        for (const auto& entry : entries)
+            if (!entry.shader->ready(parallelCompile))
+                return false;
+        return true;
+    }
+
+    // block until every program is linked and checked
+    void resolveAll()
+    {
+        for (auto& entry : entries)
+            entry.shader->resolve();
+        batchMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - batchStart).count();
+    }
+
+    bool usesParallelCompile() const { return parallelCompile; }
+
+    // per program wall time spent submitting and waiting on the driver
+    void report() const
+    {
+        std::cout << "SHADER_LIBRARY " << entries.size() << " programs, parallel compile "
+                  << (parallelCompile ? "on" : "off") << std::endl;
+        char line[160];
+        for (const auto& entry : entries)
+        {
+            const Shader& shader = *entry.shader;
+            snprintf(line, sizeof(line), "  %-16s %-8s submit %7.2f ms  wait %7.2f ms",
+                     entry.name.c_str(), shader.fromCache ? "cached" : "compiled",
+                     shader.submitMilliseconds, shader.waitMilliseconds);
+            std::cout << line << std::endl;
+        }
+        snprintf(line, sizeof(line), "  batch wall time %.2f ms", batchMilliseconds);
+        std::cout << line << std::endl;
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        std::unique_ptr<Shader> shader;
+    };
+    std::vector<Entry> entries;
+    bool parallelCompile = false;
+    std::chrono::steady_clock::time_point batchStart;
+    double batchMilliseconds = 0.0;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Which instruction sets the CPU kernels are compiled for. SSE2 is what every x64 compiler and
+// 32 bit MSVC target by default. The AVX2 kernels are compiled in next to it whatever the
+// compiler targets, each function marked SIMD_AVX2_TARGET, and only run when SimdHasAvx2()
+// finds the CPU and OS support them, so one binary runs everywhere. Anything else gets the
+// plain C++ paths.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER)
+#define SIMD_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(SIMD_AVX2)
+#if defined(__GNUC__) || defined(__clang__)
+// SIMD_AVX2_KERNEL goes on the entry point of a kernel built from lane helpers, flatten pulls
+// the helpers into it so they get its target instead of staying out of line calls
+#define SIMD_AVX2_TARGET __attribute__((target("avx2")))
+#define SIMD_AVX2_KERNEL __attribute__((target("avx2"), flatten))
+#else
+#define SIMD_AVX2_TARGET
+#define SIMD_AVX2_KERNEL
+#include <intrin.h>
+#endif
+
+// around lane templates: their AVX2 instantiation only runs inlined into a kernel, so GCC's
+// warning about AVX values crossing calls without AVX doesn't apply
+#if defined(__GNUC__) && !defined(__clang__)
+#define SIMD_LANES_BEGIN _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wpsabi\"")
+#define SIMD_LANES_END _Pragma("GCC diagnostic pop")
+#else
+#define SIMD_LANES_BEGIN
+#define SIMD_LANES_END
+#endif
+
+// the CPU has AVX2 and the OS saves the ymm registers, checked once
+inline bool SimdHasAvx2()
+{
+    static const bool available = []
+    {
+#if defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        // AVX and OSXSAVE, then XCR0 bits 1 and 2
+        __cpuid(info, 1);
+        if (((info[2] >> 27) & 1) == 0 || ((info[2] >> 28) & 1) == 0 || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return ((info[1] >> 5) & 1) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }();
+    return available;
+}
+#else
+#define SIMD_LANES_BEGIN
+#define SIMD_LANES_END
+#endif
+
+#endif
@@ -272,6 +272,27 @@ RECENT REVISION HISTORY:
 // you have issues compiling it, you can disable it entirely by
 // defining STBI_NO_SIMD.
 //
+// The PNG decoder undoes the row filters with SSE2 as well, with the
+// same results as the C loops; stbi_set_png_simd(0) turns that off.
+//
+// A single large PNG can also be decoded on more than one thread: zlib
+// inflates on a thread of its own while the calling thread unfilters the
+// rows that are already inflated, and the last Adam7 pass (half of the
+// pixels) is unfiltered on a third thread next to the other six. It is
+// off by default, stbi_set_png_pipeline(n) turns it on for images of at
+// least n inflated bytes. It needs C++11 threads, define
+// STBI_NO_PNG_THREADS to leave it out, and STBI_MALLOC/STBI_FREE have to
+// be thread safe. The output is the same either way.
+//
+// Where SSE2 is used, the YCbCr->RGB conversion and the h2v2 upsampler
+// also have AVX2 versions, 16 pixels at a time; the conversion handles
+// 3 channel output too, which SSE2 leaves to the C code. They are
+// compiled in whatever the build flags (the functions carry their own
+// target attribute on GCC/Clang), picked at run time by CPUID, and give
+// exactly the same output as the SSE2 and C versions. Define
+// STBI_NO_AVX2 to leave them out, or call stbi_set_jpeg_avx2(0) to use
+// the SSE2 kernels on a machine that has AVX2.
+//
 // ===========================================================================
 //
 // HDR image support   (disable by defining STBI_NO_HDR)
@@ -431,6 +452,16 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+// decode into a buffer of your own (a mapped pixel buffer, an arena, ...)
+// instead of one stb_image allocates: rows tightly packed, with
+// desired_channels channels (the file's if 0), flipped if flipping on
+// load is set. JPEGs write their rows straight into it; other formats
+// decode into a temporary buffer which is then copied, with the flip
+// done as part of the copy. Returns 0 (see stbi_failure_reason) if the
+// image is bad or out_size is less than width*height*channels, which
+// stbi_info_from_memory can tell you beforehand.
+STBIDEF int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, size_t out_size, int *x, int *y, int *channels_in_file, int desired_channels);
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -522,6 +553,19 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// let the JPEG decoder use its AVX2 kernels when the CPU has them (the default)
+STBIDEF void stbi_set_jpeg_avx2(int flag_true_if_should_use);
+STBIDEF void stbi_set_jpeg_avx2_thread(int flag_true_if_should_use);
+
+// let the PNG decoder undo the row filters with SSE2 where it can (the default)
+STBIDEF void stbi_set_png_simd(int flag_true_if_should_use);
+STBIDEF void stbi_set_png_simd_thread(int flag_true_if_should_use);
+
+// inflate PNGs of at least min_bytes inflated bytes on a thread of their own,
+// pipelined with the unfiltering; 0 (the default) keeps them on one thread
+STBIDEF void stbi_set_png_pipeline(int min_bytes);
+STBIDEF void stbi_set_png_pipeline_thread(int min_bytes);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -636,6 +680,16 @@ STBIDEF int   stbi_zlib_decode_noheader_buffer(char *obuffer, int olen, const ch
    #endif
 #endif
 
+// the PNG pipeline runs on C++11 threads; MSVC only reports its language
+// level in _MSVC_LANG
+#if !defined(STBI_NO_PNG) && !defined(STBI_NO_PNG_THREADS) && defined(__cplusplus)
+   #if __cplusplus >= 201103L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201103L)
+      #define STBI__PNG_THREADS
+      #include <atomic>
+      #include <thread>
+   #endif
+#endif
+
 #if defined(_MSC_VER) || defined(__SYMBIAN32__)
 typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
@@ -748,7 +802,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if !(defined(STBI_NO_JPEG) && defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -759,7 +813,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if !(defined(STBI_NO_JPEG) && defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -770,6 +824,58 @@ static int stbi__sse2_available(void)
 #endif
 
 #endif
+
+// AVX2 kernels, compiled in regardless of -mavx2 / /arch:AVX2 and
+// only called after a run-time check
+#if !defined(STBI_NO_JPEG) && !defined(STBI_NO_AVX2) && (defined(__GNUC__) || defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1700))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define STBI__AVX2_TARGET
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+static int stbi__avx2_query(void)
+{
+   int info[4];
+   __cpuid(info,0);
+   if (info[0] < 7)
+      return 0;
+   // the CPU has AVX and the OS saves the ymm registers (XCR0 bits 1 and 2)
+   __cpuid(info,1);
+   if (((info[2] >> 27) & 1) == 0 || ((info[2] >> 28) & 1) == 0 || (_xgetbv(0) & 6) != 6)
+      return 0;
+   __cpuidex(info,7,0);
+   return ((info[1] >> 5) & 1) != 0;
+}
+
+// CPUID and xgetbv are too slow to repeat on every decode; -1 until asked.
+// Every thread gets the same answer, so the cache is per thread where that
+// is available rather than a racy global
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL int stbi__avx2_cached = -1;
+#else
+static int stbi__avx2_cached = -1;
+#endif
+
+static int stbi__avx2_available(void)
+{
+   if (stbi__avx2_cached < 0)
+      stbi__avx2_cached = stbi__avx2_query();
+   return stbi__avx2_cached;
+}
+#else
+static int stbi__avx2_available(void)
+{
+   // checks the OS support for the ymm registers as well
+   return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
+#endif
+
 #endif
 
 // ARM NEON
@@ -815,6 +921,11 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   // caller's output buffer for stbi_load_from_memory_into, NULL otherwise
+   stbi_uc *into;
+   size_t into_size;
+   int into_flip;
 } stbi__context;
 
 
@@ -828,6 +939,7 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
    s->callback_already_read = 0;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
+   s->into = NULL;
 }
 
 // initialize a callback-based context
@@ -841,6 +953,7 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->img_buffer = s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
+   s->into = NULL;
 }
 
 #ifndef STBI_NO_STDIO
@@ -1132,6 +1245,69 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_avx2_global = 1;
+
+STBIDEF void stbi_set_jpeg_avx2(int flag_true_if_should_use)
+{
+   stbi__jpeg_avx2_global = flag_true_if_should_use;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_avx2  stbi__jpeg_avx2_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_avx2_local, stbi__jpeg_avx2_set;
+
+STBIDEF void stbi_set_jpeg_avx2_thread(int flag_true_if_should_use)
+{
+   stbi__jpeg_avx2_local = flag_true_if_should_use;
+   stbi__jpeg_avx2_set = 1;
+}
+
+#define stbi__jpeg_avx2  (stbi__jpeg_avx2_set          \
+                          ? stbi__jpeg_avx2_local      \
+                          : stbi__jpeg_avx2_global)
+#endif // STBI_THREAD_LOCAL
+
+static int stbi__png_simd_global = 1;
+static int stbi__png_pipeline_min_global = 0;
+
+STBIDEF void stbi_set_png_simd(int flag_true_if_should_use)
+{
+   stbi__png_simd_global = flag_true_if_should_use;
+}
+
+STBIDEF void stbi_set_png_pipeline(int min_bytes)
+{
+   stbi__png_pipeline_min_global = min_bytes;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__png_simd  stbi__png_simd_global
+#define stbi__png_pipeline_min  stbi__png_pipeline_min_global
+#else
+static STBI_THREAD_LOCAL int stbi__png_simd_local, stbi__png_simd_set;
+static STBI_THREAD_LOCAL int stbi__png_pipeline_min_local, stbi__png_pipeline_min_set;
+
+STBIDEF void stbi_set_png_simd_thread(int flag_true_if_should_use)
+{
+   stbi__png_simd_local = flag_true_if_should_use;
+   stbi__png_simd_set = 1;
+}
+
+STBIDEF void stbi_set_png_pipeline_thread(int min_bytes)
+{
+   stbi__png_pipeline_min_local = min_bytes;
+   stbi__png_pipeline_min_set = 1;
+}
+
+#define stbi__png_simd  (stbi__png_simd_set                                     \
+                          ? stbi__png_simd_local                                \
+                          : stbi__png_simd_global)
+#define stbi__png_pipeline_min  (stbi__png_pipeline_min_set                     \
+                                  ? stbi__png_pipeline_min_local                \
+                                  : stbi__png_pipeline_min_global)
+#endif // STBI_THREAD_LOCAL
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1438,6 +1614,44 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF int stbi_load_from_memory_into(stbi_uc const *buffer, int len, stbi_uc *out, size_t out_size, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__result_info ri;
+   void *result;
+   size_t row_bytes;
+   int j, channels;
+
+   stbi__start_mem(&s,buffer,len);
+   s.into = out;
+   s.into_size = out_size;
+   s.into_flip = stbi__vertically_flip_on_load;
+   result = stbi__load_main(&s, x, y, comp, req_comp, &ri, 8);
+   if (result == NULL)
+      return 0;
+   // the decoder wrote the final rows itself
+   if (result == out)
+      return 1;
+
+   channels = req_comp ? req_comp : *comp;
+   if (ri.bits_per_channel != 8) {
+      result = stbi__convert_16_to_8((stbi__uint16 *) result, *x, *y, channels);
+      if (result == NULL)
+         return 0;
+   }
+   row_bytes = (size_t) *x * channels;
+   if (out_size < row_bytes * *y) {
+      STBI_FREE(result);
+      return stbi__err("buffer too small", "Output buffer too small");
+   }
+   for (j=0; j < *y; ++j) {
+      int row = s.into_flip ? *y - 1 - j : j;
+      memcpy(out + row_bytes * row, (stbi_uc *) result + row_bytes * j, row_bytes);
+   }
+   STBI_FREE(result);
+   return 1;
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -3641,6 +3855,76 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 }
 #endif
 
+#ifdef STBI_AVX2
+STBI__AVX2_TARGET
+static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   // the SSE2 version 16 pixels at a time, see there for the math
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass, 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff);
+
+      // "prev" and "next" are curr shifted by one pixel. alignr only
+      // shifts within 128-bit lanes, so the lane crossing pixel comes in
+      // through a lane permute.
+      __m256i lohi = _mm256_permute2x128_si256(curr, curr, 0x08); // (0, lo)
+      __m256i hilo = _mm256_permute2x128_si256(curr, curr, 0x81); // (hi, 0)
+      __m256i prv0 = _mm256_alignr_epi8(curr, lohi, 14);
+      __m256i nxt0 = _mm256_alignr_epi8(hilo, curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, 3*in_near[i+16] + in_far[i+16], 15);
+
+      // horizontal pass, polyphase
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave and undo scaling. unpack and pack both work per lane,
+      // which leaves pixels 0..7 in the low lane and 8..15 in the high one
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+      __m256i outv = _mm256_packus_epi16(de0, de1);
+      _mm256_storeu_si256((__m256i *) (out + i*2), outv);
+
+      t1 = 3*in_near[i+15] + in_far[i+15];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
 static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
 {
    // resample with nearest-neighbor
@@ -3815,6 +4099,84 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+STBI__AVX2_TARGET
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   // the SSE2 version 16 pixels at a time, same arithmetic so the same
+   // results. step == 3 as well, SSE2 leaves that to the scalar loop,
+   // which computes the same thing
+   int i = 0;
+   if (step == 4 || step == 3) {
+      __m256i signflip  = _mm256_set1_epi16(-0x8000);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi16(128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load and widen to (y << 8) + 128 and cb, cr - 128 in the high byte
+         __m256i y_words  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (y+i)));
+         __m256i cr_words = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcr+i)));
+         __m256i cb_words = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (pcb+i)));
+         __m256i yw  = _mm256_or_si256(_mm256_slli_epi16(y_words, 8), y_bias);
+         __m256i crw = _mm256_xor_si256(_mm256_slli_epi16(cr_words, 8), signflip);
+         __m256i cbw = _mm256_xor_si256(_mm256_slli_epi16(cb_words, 8), signflip);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte and interleave, per 128-bit lane: the low lane
+         // ends up with pixels 0..7, the high lane with 8..15
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store in pixel order
+         __m256i p0 = _mm256_permute2x128_si256(o0, o1, 0x20);
+         __m256i p1 = _mm256_permute2x128_si256(o0, o1, 0x31);
+         if (step == 4) {
+            _mm256_storeu_si256((__m256i *) (out + 0), p0);
+            _mm256_storeu_si256((__m256i *) (out + 32), p1);
+            out += 64;
+         } else {
+            // drop the alpha bytes, pack the two 12-byte halves together
+            // and store exactly 24 bytes, so the last pixels of the image
+            // don't write past its end
+            __m256i rgb = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                           0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+            __m256i halves = _mm256_setr_epi32(0,1,2,4,5,6,7,7);
+            __m256i mask = _mm256_setr_epi32(-1,-1,-1,-1,-1,-1,0,0);
+            __m256i q0 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(p0, rgb), halves);
+            __m256i q1 = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(p1, rgb), halves);
+            _mm256_maskstore_epi32((int *) (out + 0), mask, q0);
+            _mm256_maskstore_epi32((int *) (out + 24), mask, q1);
+            out += 48;
+         }
+      }
+   }
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
@@ -3827,6 +4189,12 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
       j->idct_block_kernel = stbi__idct_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+#ifdef STBI_AVX2
+      if (stbi__jpeg_avx2 && stbi__avx2_available()) {
+         j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+         j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+      }
+#endif
    }
 #endif
 
@@ -3889,7 +4257,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    {
       int k;
       unsigned int i,j;
-      stbi_uc *output;
+      stbi_uc *output, *row = NULL;
       stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
 
       stbi__resample res_comp[4];
@@ -3917,12 +4285,27 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
       }
 
       // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      // a caller's buffer gets the rows in their final order. Some 1 and
+      // 3 channel writers store one byte more per pixel than they advance,
+      // so for those each row goes through a scratch row: the byte would
+      // land in the next row, which may already be done when flipping, or
+      // past the end of the buffer
+      if (z->s->into && z->s->into_size >= (size_t) n * z->s->img_x * z->s->img_y) {
+         output = z->s->into;
+         if (n & 1) {
+            row = (stbi_uc *) stbi__malloc_mad2(n, z->s->img_x, 1);
+            if (!row) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+         }
+      } else {
+         output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+         if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      }
 
       // now go ahead and resample
       for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
+         unsigned int final_j = output == z->s->into && z->s->into_flip ? z->s->img_y - 1 - j : j;
+         stbi_uc *final_out = output + (size_t) n * z->s->img_x * final_j;
+         stbi_uc *out = row ? row : final_out;
          for (k=0; k < decode_n; ++k) {
             stbi__resample *r = &res_comp[k];
             int y_bot = r->ystep >= (r->vs >> 1);
@@ -4014,7 +4397,10 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                   for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
             }
          }
+         if (row)
+            memcpy(final_out, row, (size_t) n * z->s->img_x);
       }
+      if (row) STBI_FREE(row);
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
       *out_y = z->s->img_y;
@@ -4184,6 +4570,9 @@ typedef struct
    int   z_expandable;
 
    stbi__zhuffman z_length, z_distance;
+#ifdef STBI__PNG_THREADS
+   std::atomic<char *> *published; // zout after every block, for a reader on another thread
+#endif
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
@@ -4481,6 +4870,9 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
          }
          if (!stbi__parse_huffman_block(a)) return 0;
       }
+      #ifdef STBI__PNG_THREADS
+      if (a->published) a->published->store(a->zout, std::memory_order_release);
+      #endif
    } while (!final);
    return 1;
 }
@@ -4491,6 +4883,9 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   #ifdef STBI__PNG_THREADS
+   a->published = NULL;
+   #endif
 
    return stbi__parse_zlib(a, parse_header);
 }
@@ -4605,11 +5000,35 @@ static int stbi__check_png_header(stbi__context *s)
    return 1;
 }
 
+#ifdef STBI__PNG_THREADS
+// the inflate thread's progress, see stbi__png_threaded
+typedef struct
+{
+   std::atomic<char *> published; // everything before this is inflated
+   std::atomic<int> finished;     // inflate returned, whether it worked or not
+} stbi__png_pipeline;
+
+// wait for the inflate thread to get past end; 0 if it stopped short of it
+static int stbi__png_wait(stbi__png_pipeline *p, stbi_uc *end)
+{
+   for (;;) {
+      int finished = p->finished.load(std::memory_order_acquire);
+      if ((stbi_uc *) p->published.load(std::memory_order_acquire) >= end) return 1;
+      if (finished) return 0;
+      std::this_thread::yield();
+   }
+}
+#endif
+
 typedef struct
 {
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   int simd; // the calling thread's stbi_set_png_simd, read here by the pipeline's threads too
+#ifdef STBI__PNG_THREADS
+   stbi__png_pipeline *pipeline; // rows wait for it when set
+#endif
 } stbi__png;
 
 
@@ -4646,6 +5065,121 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#ifdef STBI_SSE2
+static __m128i stbi__png_load4(const stbi_uc *p)
+{
+   int v;
+   memcpy(&v, p, 4);
+   return _mm_cvtsi32_si128(v);
+}
+
+static void stbi__png_store4(stbi_uc *p, __m128i x)
+{
+   int v = _mm_cvtsi128_si32(x);
+   memcpy(p, &v, 4);
+}
+
+// SSE2 versions of the row filters, for rows whose pixels keep their
+// channel count. Up is 16 independent bytes at a time. Sub is a prefix
+// sum, done over a register of 4 pixels at once. Avg and Paeth need the
+// finished pixel to the left, so they go a pixel at a time, but on all
+// of its channels at once. Only 3 and 4 byte pixels are handled, and
+// every access stays 4 bytes short of the row end; returns how many
+// bytes are done, the C loops finish the row.
+static int stbi__png_unfilter_sse2(int filter, stbi_uc *cur, stbi_uc *prior, stbi_uc *raw, int nk, int filter_bytes)
+{
+   int k = 0;
+   if (filter == STBI__F_up) {
+      for (; k+16 <= nk; k += 16) {
+         __m128i x = _mm_loadu_si128((__m128i *) (raw + k));
+         __m128i b = _mm_loadu_si128((__m128i *) (prior + k));
+         _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(x, b));
+      }
+      return k;
+   }
+   // the left pixel is loaded with 4 bytes as well, so a row with less
+   // than that is left to the C loops
+   if ((filter_bytes != 3 && filter_bytes != 4) || nk < 4)
+      return 0;
+
+   switch (filter) {
+      // paeth(a,0,0) is a, so the first row's paeth is sub
+      case STBI__F_sub:
+      case STBI__F_paeth_first:
+         if (filter_bytes == 4) {
+            __m128i last = _mm_shuffle_epi32(stbi__png_load4(cur - 4), 0);
+            for (; k+16 <= nk; k += 16) {
+               __m128i x = _mm_loadu_si128((__m128i *) (raw + k));
+               x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+               x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+               x = _mm_add_epi8(x, last);
+               _mm_storeu_si128((__m128i *) (cur + k), x);
+               last = _mm_shuffle_epi32(x, 0xff);
+            }
+         } else {
+            // 4 pixels in the low 12 bytes, the last one broadcast by shifts
+            __m128i mask = _mm_cvtsi32_si128(0xffffff);
+            __m128i last = _mm_and_si128(stbi__png_load4(cur - 3), mask);
+            last = _mm_or_si128(last, _mm_slli_si128(last, 3));
+            last = _mm_or_si128(last, _mm_slli_si128(last, 6));
+            for (; k+16 <= nk; k += 12) {
+               __m128i x = _mm_loadu_si128((__m128i *) (raw + k));
+               __m128i p;
+               x = _mm_add_epi8(x, _mm_slli_si128(x, 3));
+               x = _mm_add_epi8(x, _mm_slli_si128(x, 6));
+               x = _mm_add_epi8(x, last);
+               _mm_storel_epi64((__m128i *) (cur + k), x);
+               stbi__png_store4(cur + k + 8, _mm_srli_si128(x, 8));
+               p = _mm_and_si128(_mm_srli_si128(x, 9), mask);
+               last = _mm_or_si128(p, _mm_slli_si128(p, 3));
+               last = _mm_or_si128(last, _mm_slli_si128(last, 6));
+            }
+         }
+         break;
+      case STBI__F_avg: {
+         // (a+b)>>1, _mm_avg_epu8 rounds up
+         __m128i one = _mm_set1_epi8(1);
+         __m128i a = stbi__png_load4(cur - filter_bytes);
+         for (; k+4 <= nk; k += filter_bytes) {
+            __m128i b = stbi__png_load4(prior + k);
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(stbi__png_load4(raw + k), avg);
+            stbi__png_store4(cur + k, a);
+         }
+         break;
+      }
+      case STBI__F_paeth: {
+         // in 16 bits: p-a = b-c, p-b = a-c, p-c = (b-c)+(a-c)
+         __m128i zero = _mm_setzero_si128();
+         __m128i a = _mm_unpacklo_epi8(stbi__png_load4(cur - filter_bytes), zero);
+         __m128i c = _mm_unpacklo_epi8(stbi__png_load4(prior - filter_bytes), zero);
+         for (; k+4 <= nk; k += filter_bytes) {
+            __m128i b = _mm_unpacklo_epi8(stbi__png_load4(prior + k), zero);
+            __m128i pa = _mm_sub_epi16(b, c);
+            __m128i pb = _mm_sub_epi16(a, c);
+            __m128i pc = _mm_add_epi16(pa, pb);
+            __m128i smallest, pick_a, pick_b, nearest, x;
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            // same ties as stbi__paeth: a, then b, then c
+            pick_a = _mm_cmpeq_epi16(pa, smallest);
+            pick_b = _mm_cmpeq_epi16(pb, smallest);
+            nearest = _mm_or_si128(_mm_and_si128(pick_b, b), _mm_andnot_si128(pick_b, c));
+            nearest = _mm_or_si128(_mm_and_si128(pick_a, a), _mm_andnot_si128(pick_a, nearest));
+            x = _mm_add_epi8(stbi__png_load4(raw + k), _mm_packus_epi16(nearest, nearest));
+            stbi__png_store4(cur + k, x);
+            a = _mm_unpacklo_epi8(x, zero);
+            c = b;
+         }
+         break;
+      }
+   }
+   return k;
+}
+#endif
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
@@ -4676,7 +5210,13 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    for (j=0; j < y; ++j) {
       stbi_uc *cur = a->out + stride*j;
       stbi_uc *prior;
-      int filter = *raw++;
+      int filter;
+
+      #ifdef STBI__PNG_THREADS
+      if (a->pipeline && !stbi__png_wait(a->pipeline, raw + img_width_bytes + 1))
+         return stbi__err("not enough pixels","Corrupt PNG");
+      #endif
+      filter = *raw++;
 
       if (filter > 4)
          return stbi__err("invalid filter","Corrupt PNG");
@@ -4728,9 +5268,14 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // this is a little gross, so that we don't switch per-pixel or per-component
       if (depth < 8 || img_n == out_n) {
          int nk = (width - 1)*filter_bytes;
+         int done = 0;
+         #ifdef STBI_SSE2
+         if (filter != STBI__F_none && a->simd && stbi__sse2_available())
+            done = stbi__png_unfilter_sse2(filter, cur, prior, raw, nk, filter_bytes);
+         #endif
          #define STBI__CASE(f) \
              case f:     \
-                for (k=0; k < nk; ++k)
+                for (k=done; k < nk; ++k)
          switch (filter) {
             // "none" filter turns into a memcpy here; make that explicit.
             case STBI__F_none:         memcpy(cur, raw, nk); break;
@@ -4859,6 +5404,25 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    return 1;
 }
 
+static const int stbi__png_xorig[] = { 0,4,0,2,0,1,0 };
+static const int stbi__png_yorig[] = { 0,0,4,0,2,0,1 };
+static const int stbi__png_xspc[]  = { 8,8,4,4,2,2,1 };
+static const int stbi__png_yspc[]  = { 8,8,8,4,4,2,2 };
+
+// the pixels of Adam7 pass p, x by y, into their places in the final image
+static void stbi__png_interlace_copy(stbi__png *a, stbi_uc *final, stbi_uc *pass, int p, int x, int y, int out_bytes)
+{
+   int i,j;
+   for (j=0; j < y; ++j) {
+      for (i=0; i < x; ++i) {
+         int out_y = j*stbi__png_yspc[p]+stbi__png_yorig[p];
+         int out_x = i*stbi__png_xspc[p]+stbi__png_xorig[p];
+         memcpy(final + out_y*a->s->img_x*out_bytes + out_x*out_bytes,
+                pass + (j*x+i)*out_bytes, out_bytes);
+      }
+   }
+}
+
 static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint32 image_data_len, int out_n, int depth, int color, int interlaced)
 {
    int bytes = (depth == 16 ? 2 : 1);
@@ -4872,28 +5436,17 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
    if (!final) return stbi__err("outofmem", "Out of memory");
    for (p=0; p < 7; ++p) {
-      int xorig[] = { 0,4,0,2,0,1,0 };
-      int yorig[] = { 0,0,4,0,2,0,1 };
-      int xspc[]  = { 8,8,4,4,2,2,1 };
-      int yspc[]  = { 8,8,8,4,4,2,2 };
-      int i,j,x,y;
+      int x,y;
       // pass1_x[4] = 0, pass1_x[5] = 1, pass1_x[12] = 1
-      x = (a->s->img_x - xorig[p] + xspc[p]-1) / xspc[p];
-      y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
+      x = (a->s->img_x - stbi__png_xorig[p] + stbi__png_xspc[p]-1) / stbi__png_xspc[p];
+      y = (a->s->img_y - stbi__png_yorig[p] + stbi__png_yspc[p]-1) / stbi__png_yspc[p];
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
             STBI_FREE(final);
             return 0;
          }
-         for (j=0; j < y; ++j) {
-            for (i=0; i < x; ++i) {
-               int out_y = j*yspc[p]+yorig[p];
-               int out_x = i*xspc[p]+xorig[p];
-               memcpy(final + out_y*a->s->img_x*out_bytes + out_x*out_bytes,
-                      a->out + (j*x+i)*out_bytes, out_bytes);
-            }
-         }
+         stbi__png_interlace_copy(a, final, a->out, p, x, y, out_bytes);
          STBI_FREE(a->out);
          image_data += img_len;
          image_data_len -= img_len;
@@ -4904,6 +5457,95 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
+#ifdef STBI__PNG_THREADS
+// stbi__create_png_image with the inflating on a thread of its own: the
+// rows are unfiltered as soon as they are inflated, and the last Adam7
+// pass, which has half of the pixels, goes to another thread while this
+// one does the first six. The size of the inflated data is known from the
+// header, so it goes into one buffer that never moves. Returns 0 with
+// nothing to free if anything went wrong, and the caller decodes again the
+// usual way, which also reports the error from this thread.
+static int stbi__png_threaded(stbi__png *a, stbi__uint32 idata_len, int out_n, int depth, int color, int interlaced, int parse_header)
+{
+   stbi__context *s = a->s;
+   int bytes = (depth == 16 ? 2 : 1);
+   int out_bytes = out_n * bytes;
+   int passes = interlaced ? 7 : 1;
+   int xs[7], ys[7], p, ok = 1, last_ok = 1;
+   stbi__uint32 offsets[8];
+   stbi__png_pipeline pipeline;
+   stbi_uc *buffer, *final = NULL;
+
+   offsets[0] = 0;
+   for (p=0; p < passes; ++p) {
+      unsigned long long len;
+      xs[p] = interlaced ? (s->img_x - stbi__png_xorig[p] + stbi__png_xspc[p]-1) / stbi__png_xspc[p] : s->img_x;
+      ys[p] = interlaced ? (s->img_y - stbi__png_yorig[p] + stbi__png_yspc[p]-1) / stbi__png_yspc[p] : s->img_y;
+      len = (xs[p] && ys[p]) ? ((((unsigned long long) s->img_n * xs[p] * depth + 7) >> 3) + 1) * ys[p] : 0;
+      if (offsets[p] + len > (1u << 30)) return 0;
+      offsets[p+1] = offsets[p] + (stbi__uint32) len;
+   }
+   buffer = (stbi_uc *) stbi__malloc(offsets[passes]);
+   if (!buffer) return 0;
+   if (interlaced) {
+      final = (stbi_uc *) stbi__malloc_mad3(s->img_x, s->img_y, out_bytes, 0);
+      if (!final) { STBI_FREE(buffer); return 0; }
+   }
+
+   pipeline.published.store((char *) buffer);
+   pipeline.finished.store(0);
+   std::thread inflater([&] {
+      stbi__zbuf z;
+      z.zbuffer = a->idata;
+      z.zbuffer_end = a->idata + idata_len;
+      z.zout_start = z.zout = (char *) buffer;
+      z.zout_end = (char *) buffer + offsets[passes];
+      z.z_expandable = 0;
+      z.published = &pipeline.published;
+      // if this fails, the rows it did not get to fail to unfilter
+      stbi__parse_zlib(&z, parse_header);
+      pipeline.finished.store(1, std::memory_order_release);
+   });
+
+   a->pipeline = &pipeline;
+   if (!interlaced) {
+      ok = stbi__create_png_image_raw(a, buffer, offsets[1], out_n, xs[0], ys[0], depth, color);
+   } else {
+      // a copy of its own for the last pass, a->out changes under it
+      stbi__png b = *a;
+      std::thread last;
+      if (xs[6] && ys[6]) {
+         last = std::thread([&] {
+            last_ok = stbi__create_png_image_raw(&b, buffer + offsets[6], offsets[7] - offsets[6], out_n, xs[6], ys[6], depth, color);
+            if (last_ok) stbi__png_interlace_copy(&b, final, b.out, 6, xs[6], ys[6], out_bytes);
+            STBI_FREE(b.out);
+         });
+      }
+      for (p=0; p < 6 && ok; ++p) {
+         if (!xs[p] || !ys[p]) continue;
+         ok = stbi__create_png_image_raw(a, buffer + offsets[p], offsets[p+1] - offsets[p], out_n, xs[p], ys[p], depth, color);
+         if (ok) stbi__png_interlace_copy(a, final, a->out, p, xs[p], ys[p], out_bytes);
+         STBI_FREE(a->out);
+         a->out = NULL;
+      }
+      if (last.joinable()) last.join();
+      ok = ok && last_ok;
+      if (ok) a->out = final;
+   }
+   inflater.join();
+   a->pipeline = NULL;
+
+   if (!ok) {
+      if (!interlaced) { STBI_FREE(a->out); a->out = NULL; }
+      STBI_FREE(final);
+      STBI_FREE(buffer);
+      return 0;
+   }
+   a->expanded = buffer;
+   return 1;
+}
+#endif
+
 static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
 {
    stbi__context *s = z->s;
@@ -5088,6 +5730,10 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
    z->expanded = NULL;
    z->idata = NULL;
    z->out = NULL;
+   z->simd = stbi__png_simd;
+   #ifdef STBI__PNG_THREADS
+   z->pipeline = NULL;
+   #endif
 
    if (!stbi__check_png_header(s)) return 0;
 
@@ -5203,14 +5849,22 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
-            if (z->expanded == NULL) return 0; // zlib should set error
-            STBI_FREE(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
                s->img_out_n = s->img_n+1;
             else
                s->img_out_n = s->img_n;
-            if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            #ifdef STBI__PNG_THREADS
+            if (stbi__png_pipeline_min > 0 && raw_len >= (stbi__uint32) stbi__png_pipeline_min &&
+                stbi__png_threaded(z, ioff, s->img_out_n, z->depth, color, interlace, !is_iphone)) {
+               STBI_FREE(z->idata); z->idata = NULL;
+            } else
+            #endif
+            {
+               z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+               if (z->expanded == NULL) return 0; // zlib should set error
+               STBI_FREE(z->idata); z->idata = NULL;
+               if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
+            }
             if (has_trans) {
                if (z->depth == 16) {
                   if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
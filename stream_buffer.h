@@ -0,0 +1,159 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+// Ring buffer for data written by the CPU every frame (sprites, particles, debug lines, per
+// frame constants). The buffer is split into one section per frame in flight, each guarded by
+// a fence, so the CPU never writes over data the GPU may still read and never waits for the
+// driver to copy.
+//
+// On GL 4.4 the whole buffer is created with glBufferStorage and stays mapped persistent and
+// coherent. On GL 3.3 each frame's section is mapped unsynchronized (the fence already did the
+// synchronizing) and unmapped again in commit().
+//
+// Per frame: beginFrame(), allocate() and fill, commit(), then issue the draws that read it.
+struct StreamAllocation
+{
+    void* data;       // where to write, nullptr if the frame's section is full
+    GLintptr offset;  // the same place as an offset into buffer()
+};
+
+class StreamBuffer
+{
+public:
+    static constexpr int MAX_FRAMES = 4;
+
+    StreamBuffer(GLenum target, size_t bytesPerFrame, int framesInFlight = 3)
+        : target(target), sectionSize(bytesPerFrame),
+          frames(framesInFlight < MAX_FRAMES ? framesInFlight : MAX_FRAMES)
+    {
+        persistent = GLAD_GL_VERSION_4_4 != 0;
+        glGenBuffers(1, &id);
+        glState.bindBuffer(target, id);
+        const size_t total = sectionSize * frames;
+        if (persistent)
+        {
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, total, nullptr, flags);
+            mapped = static_cast<char*>(glMapBufferRange(target, 0, total, flags));
+            if (!mapped)
+            {
+                std::cout << "ERROR::STREAM_BUFFER::PERSISTENT_MAP_FAILED" << std::endl;
+            }
+        }
+        else
+        {
+            glBufferData(target, total, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    ~StreamBuffer()
+    {
+        for (auto& fence : fences)
+            if (fence)
+                glDeleteSync(fence);
+        glState.bindBuffer(target, id);
+        if (mapped || sectionData)
+            glUnmapBuffer(target);
+        glState.deleteBuffer(id);
+    }
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    // move to the next section, waiting for the GPU to finish the frame that last used it
+    void beginFrame()
+    {
+        // everything that reads the current section has been issued by now
+        if (active)
+        {
+            commit();
+            fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            section = (section + 1) % frames;
+        }
+        active = true;
+        used = 0;
+
+        if (GLsync fence = fences[section])
+        {
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+                stalls++;
+                while (result == GL_TIMEOUT_EXPIRED)
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            }
+            glDeleteSync(fence);
+            fences[section] = nullptr;
+        }
+
+        if (persistent)
+        {
+            sectionData = mapped ? mapped + section * sectionSize : nullptr;
+        }
+        else
+        {
+            glState.bindBuffer(target, id);
+            const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+                                     GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+            sectionData = static_cast<char*>(glMapBufferRange(target, section * sectionSize, sectionSize, flags));
+        }
+    }
+
+    // carve size bytes out of this frame's section. alignment must be a power of two,
+    // use GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT for uniform ranges.
+    StreamAllocation allocate(size_t size, size_t alignment = 16)
+    {
+        const size_t start = (used + alignment - 1) & ~(alignment - 1);
+        if (!sectionData || start + size > sectionSize)
+        {
+            overflows++;
+            return StreamAllocation{ nullptr, 0 };
+        }
+        used = start + size;
+        return StreamAllocation{ sectionData + start, (GLintptr)(section * sectionSize + start) };
+    }
+
+    // make this frame's writes visible to GL, call before the draws that read them.
+    // A no-op for the persistent mapping, which is coherent.
+    void commit()
+    {
+        if (persistent || !sectionData)
+            return;
+        glState.bindBuffer(target, id);
+        if (used > 0)
+            glFlushMappedBufferRange(target, 0, used);
+        glUnmapBuffer(target);
+        sectionData = nullptr;
+    }
+
+    GLuint buffer() const { return id; }
+    bool isPersistent() const { return persistent; }
+    size_t bytesUsed() const { return used; }
+    // frames that had to wait on the GPU, and allocations that did not fit
+    uint32_t stallCount() const { return stalls; }
+    uint32_t overflowCount() const { return overflows; }
+
+private:
+    GLenum target;
+    GLuint id = 0;
+    size_t sectionSize;
+    int frames;
+    bool persistent = false;
+    bool active = false;
+    int section = 0;
+    size_t used = 0;
+    char* mapped = nullptr;
+    char* sectionData = nullptr;
+    GLsync fences[MAX_FRAMES] = {};
+    uint32_t stalls = 0;
+    uint32_t overflows = 0;
+};
+
+#endif
@@ -3,11 +3,36 @@
 #include <iostream>
 #include <Eigen/Dense>
 #include "shader.h"
+#include "shader_library.h"
+#include "gl_state.h"
+#include "render_queue.h"
+#include "instanced_mesh.h"
+#include "benchmark.h"
+#include "frame_constants.h"
+#include "texture.h"
+#include "texture_container.h"
+#include "texture_cache.h"
+#include "texture_atlas.h"
+#include "frustum_cull.h"
+#include "scene_depth.h"
+#include "scene_graph.h"
+#include "bvh.h"
+#include "job_system.h"
 #include "utils.h"
 #include <algorithm>
+#include <cstring>
+#include <optional>
 
+// stb allocates through the scratch pools of the ImageDecoders, see image_decode.h
+#define STBI_MALLOC ImageScratchAllocate
+#define STBI_REALLOC ImageScratchReallocate
+#define STBI_FREE ImageScratchFree
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+// ImageDecodeOptions relies on stb keeping its settings per thread
+#ifndef STBI_THREAD_LOCAL
+#error "stb_image was built without thread locals, parallel decoding would race on its settings"
+#endif
 using Eigen::Matrix4f;
 using Eigen::Vector4f;
 using Eigen::Vector3f;
@@ -27,6 +52,8 @@ float yaw = -PI/2;
 float pitch = 0.0f;
 bool firstMouse = false;
 float fov = PI * 0.25;
+// the scene's depth target, resized with the window once the render loop runs
+SceneDepth* sceneDepth = nullptr;
 
 //Key Press Input
 void processInput(GLFWwindow* window)
@@ -71,6 +98,8 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
+    if (sceneDepth)
+        sceneDepth->resize(width, height);
 }
 
 
@@ -107,59 +136,85 @@ GLFWwindow* InitWindow(int width, int height) {
     return window;
 }
 
-unsigned int GenerateTexture(const char* fileName, const bool alpha = false, const bool flipY = false)
-{
-    unsigned int texture1;
-    glGenTextures(1, &texture1);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    // set the texture wrapping/filtering options (on the currently bound texture object)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-
-
-    int width, height, nrChannels;
-    if(flipY)
-        stbi_set_flip_vertically_on_load(true);
-    unsigned char* data = stbi_load(fileName, &width, &height, &nrChannels, 0);
-    if (data)
+int main(int argc, char** argv) {
+    // --convert <image> <container> [--flip] [--bc] writes a .tex container and exits. The build
+    // runs it over the textures below, see the post build step of the project.
+    if (argc > 1 && strcmp(argv[1], "--convert") == 0)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, alpha?GL_RGBA:GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        if (argc < 4)
+        {
+            std::cout << "usage: " << argv[0] << " --convert <image> <container> [--flip] [--bc]" << std::endl;
+            return -1;
+        }
+        bool flipY = false, compress = false;
+        for (int i = 4; i < argc; i++)
+        {
+            flipY |= strcmp(argv[i], "--flip") == 0;
+            compress |= strcmp(argv[i], "--bc") == 0;
+        }
+        // one image with nothing else running, so a big PNG inflates on a thread of its own
+        stbi_set_png_pipeline_thread(4 << 20);
+        return ConvertToTextureContainer(argv[2], argv[3], flipY, compress) ? 0 : -1;
     }
-    else
+    // --atlas <atlas> [--flip] <image>... packs the images into an .atlas file and exits, the
+    // entries come out in the order of the images. --flip applies to the image after it.
+    if (argc > 1 && strcmp(argv[1], "--atlas") == 0)
     {
-        std::cout << "Failed to load texture" << std::endl;
+        if (argc < 4)
+        {
+            std::cout << "usage: " << argv[0] << " --atlas <atlas> [--flip] <image>..." << std::endl;
+            return -1;
+        }
+        TextureAtlasBuilder atlas;
+        bool flipY = false;
+        for (int i = 3; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--flip") == 0)
+            {
+                flipY = true;
+                continue;
+            }
+            if (atlas.addFile(argv[i], flipY) < 0)
+                return -1;
+            flipY = false;
+        }
+        return atlas.build() && atlas.write(argv[2]) ? 0 : -1;
     }
-    stbi_image_free(data);
-    return texture1;
-}
 
-
-int main() {
+    // --bench runs the benchmarks against the scene below instead of the render loop
+    const bool runBenchmarks = argc > 1 && strcmp(argv[1], "--bench") == 0;
+    // --reversed-z and --infinite-far pick the depth setup of the render loop
+    DepthMode depthMode;
+    for (int i = 1; i < argc; i++)
+    {
+        depthMode.reversedZ |= strcmp(argv[i], "--reversed-z") == 0;
+        depthMode.infiniteFar |= strcmp(argv[i], "--infinite-far") == 0;
+    }
 
 	const auto window = InitWindow(1200,800);
     if (!window) {
         return -1;
     }
-    glEnable(GL_DEPTH_TEST);
+    glState.enable(GL_DEPTH_TEST);
     //This hides the cursor and limits its movement within the window
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
-    // Create the shader program
-    Shader program_orange("vertex.vert", "orange.frag");
-    Shader program_blue("vertex.vert", "blue.frag");
-    Shader program_txtr("vertex.vert", "txtr.frag");
+    // Create the shader programs. They compile in the background while we set up the buffers
+    ShaderLibrary shaders((GLADloadproc)glfwGetProcAddress);
+    // only drawn by the disabled regions in the render loop, which look them up by name
+    shaders.add("orange", "vertex.vert", "orange.frag");
+    shaders.add("blue", "vertex.vert", "blue.frag");
+    Shader& program_txtr = shaders.add("txtr", "vertex.vert", "txtr.frag");
+    Shader& program_txtr_instanced = shaders.add("txtr_instanced", "vertex_instanced.vert", "txtr.frag");
+    Shader& program_atlas = shaders.add("atlas", "vertex_atlas.vert", "atlas.frag");
 
 #pragma region Triangle with vertex color
     //Generate a Vertex Array Object
     unsigned int vao_triangle;
     glGenVertexArrays(1, &vao_triangle);
     // 1. bind Vertex Array Object
-    glBindVertexArray(vao_triangle);
+    glState.bindVertexArray(vao_triangle);
     //generate a VBO
     unsigned int vbo_vertColor;
     glGenBuffers(1, &vbo_vertColor);
@@ -173,7 +228,7 @@ int main() {
     };
 
     // 2. copy our vertices array in a buffer for OpenGL to use
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_vertColor);
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo_vertColor);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_triangle), vertices_triangle, GL_STATIC_DRAW);
     // 3. then set our vertex attributes pointers
     // position attribute
@@ -188,7 +243,7 @@ int main() {
     //Using elements and indices 
     unsigned int vao_rect;
     glGenVertexArrays(1, &vao_rect);
-    glBindVertexArray(vao_rect);
+    glState.bindVertexArray(vao_rect);
     unsigned int vbo_rect;
     glGenBuffers(1, &vbo_rect);
 	constexpr float vertices_rect[] = {
@@ -197,7 +252,7 @@ int main() {
         -0.5f, -0.5f, 0.0f,  // bottom left
         -0.5f,  0.5f, 0.0f   // top left 
     };
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_rect);
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo_rect);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_rect), vertices_rect, GL_STATIC_DRAW);
 	const unsigned int indices[] = {  // note that we start from 0!
         0, 1, 3,   // first triangle
@@ -206,7 +261,7 @@ int main() {
     //Get an element buffer instead
     unsigned int ebo;
     glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -214,13 +269,18 @@ int main() {
 
 
 #pragma region Textures
+    JobSystem jobs;
+    // textures stay under this many bytes, the least recently drawn drop to a small mip
+    TextureCache textureCache(jobs, 256u << 20);
     //Get a texture please
     unsigned int vao_txtr;
     glGenVertexArrays(1, &vao_txtr);
-    glBindVertexArray(vao_txtr);
+    glState.bindVertexArray(vao_txtr);
 
-	const auto texture1 = GenerateTexture("uv.jpg");
-	const auto texture2 = GenerateTexture("face.png",true,true);
+	// the converted containers upload straight from a mapping. Without them the images are
+	// decoded on the workers, and the quad shows a white placeholder until they are uploaded.
+	auto texture1 = textureCache.load("uv.jpg", false, "uv.tex");
+	auto texture2 = textureCache.load("face.png", true, "face.tex");
 
 	constexpr float vertices_txtr[] = {
 	    // positions          // colors           // texture coords
@@ -231,7 +291,7 @@ int main() {
     };
     unsigned int vbo_txtr;
     glGenBuffers(1, &vbo_txtr);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo_txtr);
+    glState.bindBuffer(GL_ARRAY_BUFFER, vbo_txtr);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_txtr), vertices_txtr, GL_STATIC_DRAW);
 
     // position attribute
@@ -243,14 +303,83 @@ int main() {
     glEnableVertexAttribArray(2);
     unsigned int ebo_txtr;
     glGenBuffers(1, &ebo_txtr);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_txtr);
+    glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo_txtr);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    shaders.resolveAll();
+    shaders.report();
     program_txtr.use();
     program_txtr.setInt("texture1", 0);
     program_txtr.setInt("texture2", 1);
+    // resolve the per-frame uniforms once instead of by name every frame
+    const UniformHandle u_model = program_txtr.getUniform("model");
+    program_txtr_instanced.use();
+    program_txtr_instanced.setInt("texture1", 0);
+    program_txtr_instanced.setInt("texture2", 1);
+    program_atlas.use();
+    program_atlas.setInt("atlas", 0);
 #pragma endregion
 
+    // view, projection, camera and time for every program, one upload per frame
+    FrameConstantsBuffer frameConstants;
+
+    if (runBenchmarks)
+    {
+        textureCache.finish();
+        glState.bindTexture(0, GL_TEXTURE_2D, texture1);
+        glState.bindTexture(1, GL_TEXTURE_2D, texture2);
+        const auto mat_view = GetLookAtMat(cameraPos, cameraPos + cameraFront, cameraUp);
+        const auto mat_pers = GetMatPerspectiveProjection(fov, (float)width / (float)height, 0.1, 100.0);
+        frameConstants.update(mat_view, mat_pers, cameraPos, 0.0f, 0.0f);
+        {
+            // copies of the textured quad drawn with one call, in a VAO of their own
+            InstancedMesh quads(vao_txtr, 6);
+            BenchmarkInstancing(program_txtr, program_txtr_instanced, vao_txtr, quads);
+            BenchmarkTextureUpload(jobs);
+            BenchmarkMipmaps();
+            BenchmarkBlockCompression();
+            BenchmarkTextureCache(jobs);
+            BenchmarkAtlas(program_txtr, program_atlas, vao_txtr, quads);
+            BenchmarkJpegDecode();
+            BenchmarkPngDecode();
+            BenchmarkDecodeInto();
+            BenchmarkImageProbe();
+            BenchmarkTransforms(jobs);
+            BenchmarkCulling(jobs);
+            BenchmarkSceneGraph(jobs);
+            BenchmarkBvh(jobs);
+        }
+        // the cache outlives the context otherwise
+        textureCache.release();
+        glfwTerminate();
+        return 0;
+    }
+
+
 
+    // draws are collected each frame and sorted by state before they reach the driver
+    RenderQueue renderQueue;
+    // its destructor deletes the framebuffer and restores GL state, so it is reset before the context goes
+    std::optional<SceneDepth> depth(std::in_place, depthMode, width, height);
+    sceneDepth = &*depth;
+    std::cout << "Depth: " << (depth->mode().reversedZ ? "reversed-Z" : "standard") << ", "
+              << (depth->mode().infiniteFar ? "infinite far plane" : "finite far plane") << std::endl;
+    // only what intersects the view frustum is submitted. The quad spans -0.5..0.5, so its
+    // bounding sphere has a radius of sqrt(0.5) around its model origin.
+    FrustumCuller culler(jobs);
+    SphereBatch sceneBounds;
+    sceneBounds.resize(1);
+    // the quad's model transform, a world matrix recomputed only when a node changes
+    SceneGraph scene;
+    const uint32_t quadNode = scene.add(SceneGraph::NO_PARENT, Vector3f::Zero(),
+                                        Eigen::Quaternionf(Eigen::AngleAxis<float>(PI * 0.25, Vector3f(0, 0, 1))));
+    // world space boxes of the scene's objects in a BVH, refit when the scene graph moves them,
+    // for picking whatever is straight ahead of the camera
+    BoxBatch sceneBoxes;
+    sceneBoxes.resize(1);
+    Bvh sceneBvh;
+    // what the last frame picked, and how many frames picked anything, for the end of run stats
+    BvhHit picked;
+    uint32_t pickedFrames = 0;
 
     //The main render loop
     while (!glfwWindowShouldClose(window))
@@ -264,6 +393,10 @@ int main() {
         //Input
         processInput(window);
 
+        // finished texture loads go to the GPU, then the cache evicts down to its budget
+        textureCache.update();
+
+        depth->beginFrame();
         //clearing color
         glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
@@ -276,6 +409,7 @@ int main() {
 
          //4. draw the object
 //#pragma region Draw Rect with changing color
+//        Shader& program_blue = *shaders.get("blue");
 //        program_blue.use();
 //        float blueValue = sin(timeValue) / 2.0f + 0.5f;
 //        program_blue.setFloat4("ourColor", 0.f, 0.f, blueValue, 1.0f);
@@ -284,44 +418,91 @@ int main() {
 //#pragma endregion
 //
 //#pragma region Draw Triangle with Vertex Color
-//        program_orange.use();
+//        shaders.get("orange")->use();
 //        glBindVertexArray(VAO_triangle);
 //        glDrawArrays(GL_TRIANGLES, 0, 3);
 //#pragma endregion
 
 
 #pragma region Transformation matrices
-        Matrix4f mat_trans = Matrix4f::Identity();
-        Eigen::Quaternion<float> quat;
-        quat = Eigen::AngleAxis<float>(PI * 0.25, Vector3f(0, 0, 1));
-        mat_trans.block<3, 3>(0, 0) = quat.normalized().toRotationMatrix();
-        program_txtr.setMat4f("model", mat_trans);
+        scene.update(jobs);
+        const Matrix4f& mat_trans = scene.world(quadNode);
+        if (scene.lastUpdated() > 0)
+        {
+            const Eigen::AlignedBox3f quadBox = Eigen::AlignedBox3f(Vector3f(-0.5f, -0.5f, 0.0f), Vector3f(0.5f, 0.5f, 0.0f))
+                                                    .transformed(Eigen::Affine3f(mat_trans));
+            sceneBoxes.set(0, quadBox.min(), quadBox.max());
+            if (sceneBvh.empty())
+                sceneBvh.build(jobs, sceneBoxes);
+            else
+                sceneBvh.refit(jobs, sceneBoxes);
+        }
+        picked = sceneBvh.raycast(cameraPos, cameraFront, sceneBoxes);
+        pickedFrames += picked.hit();
 
         // Not the actual Direction, reversed
      
 
 
+        constexpr float zNear = 0.1f, zFar = 100.0f;
         auto mat_view = GetLookAtMat(cameraPos, cameraPos + cameraFront, cameraUp);
-    	program_txtr.setMat4f("view", mat_view);
-        auto mat_pers = GetMatPerspectiveProjection(fov, (float)width / (float)height, 0.1, 100.0);
-        program_txtr.setMat4f("projection", mat_pers);
+        auto mat_pers = depth->projection(fov, (float)width / (float)height, zNear, zFar);
+        frameConstants.update(mat_view, mat_pers, cameraPos, currentFrame, deltaTime);
 
 #pragma endregion
 
 
-        program_txtr.use();
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture1);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, texture2);
-        glBindVertexArray(vao_txtr);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        renderQueue.reset();
+        sceneBounds.set(0, mat_trans.block<3, 1>(0, 3), 0.7072f);
+        // one object for now, so the visible list is either empty or just the quad
+        if (!culler.cull(ExtractFrustum(mat_pers * mat_view, depth->zeroToOneDepth()), sceneBounds).empty())
+        {
+            DrawPacket quad{};
+            quad.program = program_txtr.ID;
+            quad.vertexArray = vao_txtr;
+            quad.textures[0] = texture1;
+            quad.textures[1] = texture2;
+            textureCache.touch(texture1);
+            textureCache.touch(texture2);
+            quad.textureCount = 2;
+            quad.indexCount = 6;
+            quad.modelLocation = u_model.location;
+            memcpy(quad.model, mat_trans.data(), sizeof(quad.model));
+            // view space looks down -z
+            const float viewDepth = -(mat_view * mat_trans.col(3)).z();
+            renderQueue.submit(quad, (viewDepth - zNear) / (zFar - zNear));
+        }
+        culler.endFrame();
+        renderQueue.execute();
+        depth->endFrame();
+        glState.endFrame();
 
 
         //swap buffer
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+    if (glState.frameCount() > 0)
+    {
+        const auto& calls = glState.totals();
+        std::cout << "GL state: " << (double)calls.issued / glState.frameCount() << " calls issued, "
+                  << (double)calls.elided / glState.frameCount() << " elided per frame" << std::endl;
+        const auto& textures = textureCache.totals();
+        std::cout << "Textures: " << textureCache.residentBytes() / 1024 << " KB resident, " << textures.evictions
+                  << " evictions, " << textures.streamIns << " stream-ins, "
+                  << textureCache.averageStreamInMilliseconds() << " ms average stream-in" << std::endl;
+        const auto& culled = culler.totals();
+        std::cout << "Culling: " << (double)culled.visible / culler.frameCount() << " visible, "
+                  << (double)culled.culled / culler.frameCount() << " culled per frame" << std::endl;
+        std::cout << "Picking: something on " << pickedFrames << " of " << glState.frameCount() << " frames, last ";
+        if (picked.hit())
+            std::cout << "object " << picked.index << " at distance " << picked.distance << std::endl;
+        else
+            std::cout << "nothing" << std::endl;
+    }
+    sceneDepth = nullptr;
+    depth.reset();
+    textureCache.release();
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
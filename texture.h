@@ -0,0 +1,56 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+
+#include <cstddef>
+
+// set the texture wrapping/filtering options (on the currently bound texture object)
+inline void SetDefaultTextureParameters()
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// client side format and sized internal format for 8 bit images with the given channel count
+inline GLenum PixelFormatForChannels(int channels)
+{
+    switch (channels)
+    {
+    case 1: return GL_RED;
+    case 2: return GL_RG;
+    case 3: return GL_RGB;
+    default: return GL_RGBA;
+    }
+}
+
+inline GLenum InternalFormatForChannels(int channels)
+{
+    switch (channels)
+    {
+    case 1: return GL_R8;
+    case 2: return GL_RG8;
+    case 3: return GL_RGB8;
+    default: return GL_RGBA8;
+    }
+}
+
+// one level into the texture bound for update, tightly packed. format 0 means data holds
+// blocks of the compressed internalFormat.
+inline void UploadTextureLevel(GLenum target, GLint level, GLenum internalFormat, GLenum format, GLenum type,
+                               int width, int height, const void* data, size_t size)
+{
+    if (format == 0)
+    {
+        glCompressedTexImage2D(target, level, internalFormat, width, height, 0, (GLsizei)size, data);
+        return;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(target, level, (GLint)internalFormat, width, height, 0, format, type, data);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+#endif
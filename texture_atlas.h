@@ -0,0 +1,498 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+#include "image_decode.h"
+#include "image_probe.h"
+#include "mipmap.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+// Many small images packed into the layers of one GL_TEXTURE_2D_ARRAY, so quads that each show
+// a different image can share a bind and go out in one instanced draw. Each image sits in its
+// own slot, surrounded by a gutter of its repeated edge texels so bilinear filtering and the mip
+// levels never pull in a neighbour. Slots are aligned to the gutter, which makes the levels down
+// to gutter texels wide clean; the array stops there (GL_TEXTURE_MAX_LEVEL).
+//
+// A quad shows its image with uv' = uvOffset + uv * uvScale on layer `layer`, see
+// vertex_atlas.vert. Packed at runtime with TextureAtlasBuilder, or ahead of time into an .atlas
+// file with --atlas (see test.cpp) and mapped by LoadTextureAtlas.
+
+struct AtlasRect
+{
+    int x, y, width, height;
+};
+
+// where one image ended up, laid out to be fed straight to the shader as an instance attribute
+struct AtlasEntry
+{
+    float uvOffset[2];
+    float uvScale[2];
+    float layer;
+};
+
+// Bottom-left skyline packing of rectangles into one page. The skyline is the top edge of what
+// is placed so far, as segments from left to right; a rectangle goes where its top ends up
+// lowest, on the narrowest segment when that ties.
+class SkylinePacker
+{
+public:
+    SkylinePacker(int width, int height) : width(width), height(height)
+    {
+        skyline.push_back(Segment{ 0, 0, width });
+    }
+
+    // false if the rectangle no longer fits the page
+    bool insert(int rectWidth, int rectHeight, AtlasRect& rect)
+    {
+        size_t best = skyline.size();
+        int bestY = 0, bestTop = INT_MAX, bestWidth = INT_MAX;
+        for (size_t i = 0; i < skyline.size(); i++)
+        {
+            int y;
+            if (!fits(i, rectWidth, rectHeight, y))
+                continue;
+            if (y + rectHeight < bestTop || (y + rectHeight == bestTop && skyline[i].width < bestWidth))
+            {
+                best = i;
+                bestY = y;
+                bestTop = y + rectHeight;
+                bestWidth = skyline[i].width;
+            }
+        }
+        if (best == skyline.size())
+            return false;
+
+        rect = AtlasRect{ skyline[best].x, bestY, rectWidth, rectHeight };
+        skyline.insert(skyline.begin() + best, Segment{ rect.x, bestTop, rectWidth });
+        // the segments now under the new one shrink or go
+        const int right = rect.x + rectWidth;
+        for (size_t i = best + 1; i < skyline.size();)
+        {
+            Segment& segment = skyline[i];
+            if (segment.x >= right)
+                break;
+            const int covered = right - segment.x;
+            if (segment.width <= covered)
+            {
+                skyline.erase(skyline.begin() + i);
+                continue;
+            }
+            segment.x += covered;
+            segment.width -= covered;
+            break;
+        }
+        for (size_t i = 0; i + 1 < skyline.size();)
+        {
+            if (skyline[i].y == skyline[i + 1].y)
+            {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase(skyline.begin() + i + 1);
+            }
+            else
+            {
+                i++;
+            }
+        }
+        used += (size_t)rectWidth * rectHeight;
+        return true;
+    }
+
+    // share of the page covered by rectangles
+    float occupancy() const { return (float)used / ((float)width * height); }
+
+private:
+    struct Segment
+    {
+        int x, y, width;
+    };
+
+    int width, height;
+    std::vector<Segment> skyline;
+    size_t used = 0;
+
+    // the height a rectangle starting at segment index would rest at
+    bool fits(size_t index, int rectWidth, int rectHeight, int& y) const
+    {
+        if (skyline[index].x + rectWidth > width)
+            return false;
+        y = 0;
+        int remaining = rectWidth;
+        for (size_t i = index; remaining > 0; i++)
+        {
+            y = std::max(y, skyline[i].y);
+            if (y + rectHeight > height)
+                return false;
+            remaining -= skyline[i].width;
+        }
+        return true;
+    }
+};
+
+struct TextureAtlasHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pageSize;
+    uint32_t layerCount;
+    uint32_t levelCount;
+    uint32_t entryCount;
+};
+constexpr uint32_t TEXTURE_ATLAS_MAGIC = 0x534C5441; // "ATLS"
+constexpr uint32_t TEXTURE_ATLAS_VERSION = 1;
+constexpr uint64_t TEXTURE_ATLAS_ALIGNMENT = 16;
+
+// layers * size * size RGBA8 texels per level, the levels one after the other and aligned
+inline std::vector<uint64_t> TextureAtlasLevelOffsets(uint32_t pageSize, uint32_t layerCount, uint32_t levelCount,
+                                                      uint32_t entryCount)
+{
+    std::vector<uint64_t> offsets;
+    uint64_t offset = sizeof(TextureAtlasHeader) + sizeof(AtlasEntry) * (uint64_t)entryCount;
+    uint64_t size = pageSize;
+    for (uint32_t level = 0; level < levelCount; level++)
+    {
+        offset = (offset + TEXTURE_ATLAS_ALIGNMENT - 1) & ~(TEXTURE_ATLAS_ALIGNMENT - 1);
+        offsets.push_back(offset);
+        offset += size * size * 4 * layerCount;
+        size = std::max<uint64_t>(size / 2, 1);
+    }
+    offsets.push_back(offset); // the end of the file
+    return offsets;
+}
+
+// a new GL_TEXTURE_2D_ARRAY with the given levels, each holding every layer. 0 if the driver
+// can't take that many layers.
+inline unsigned int UploadTextureAtlas(int pageSize, int layerCount, const std::vector<const unsigned char*>& levels)
+{
+    GLint maxLayers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+    if (layerCount > maxLayers)
+    {
+        std::cout << "ERROR::TEXTURE_ATLAS::TOO_MANY_LAYERS " << layerCount << " of " << maxLayers << std::endl;
+        return 0;
+    }
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glState.bindTextureForUpdate(GL_TEXTURE_2D_ARRAY, texture);
+    // the gutters handle the edges, clamping keeps a quad's UVs from wrapping into another slot
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+    int size = pageSize;
+    for (size_t level = 0; level < levels.size(); level++)
+    {
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, GL_RGBA8, size, size, layerCount, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, levels[level]);
+        size = MipExtent(size);
+    }
+    return texture;
+}
+
+// Collects images, packs them into square pages and builds the levels. Needs no GL context
+// except for upload(), so it runs at import time as well.
+class TextureAtlasBuilder
+{
+public:
+    // gutter: texels of repeated edge around each image, a power of two; the atlas gets
+    // log2(gutter) + 1 levels
+    explicit TextureAtlasBuilder(int pageSize = 2048, int gutter = 8, const MipmapOptions& mipmaps = MipmapOptions{})
+        : size(pageSize), gutter(gutter), mipmaps(mipmaps)
+    {
+        alignment = 1;
+        while (alignment * 2 <= gutter)
+            alignment *= 2;
+        levels = 1;
+        while ((1 << (levels - 1)) < alignment && MipLevelCount(pageSize, pageSize) > levels)
+            levels++;
+    }
+
+    // copy an image in, returns its index into entries(). 1 and 2 channel images become gray
+    // (and alpha), like stb_image converts them.
+    int add(const unsigned char* pixels, int width, int height, int channels)
+    {
+        Image image{ width, height, std::vector<unsigned char>((size_t)width * height * 4) };
+        for (size_t i = 0; i < (size_t)width * height; i++)
+        {
+            const unsigned char* source = pixels + i * channels;
+            unsigned char* target = image.pixels.data() + i * 4;
+            const bool gray = channels < 3;
+            target[0] = source[0];
+            target[1] = gray ? source[0] : source[1];
+            target[2] = gray ? source[0] : source[2];
+            target[3] = channels == 2 ? source[1] : channels == 4 ? source[3] : 255;
+        }
+        images.push_back(std::move(image));
+        return (int)images.size() - 1;
+    }
+
+    // -1 if the file can't be read or decoded, or is bigger than a page. The header is probed
+    // first, so an image that can't fit is turned away before decoding and the rest decode
+    // straight into their RGBA copy.
+    int addFile(const char* path, bool flipY = false)
+    {
+        std::vector<unsigned char> bytes;
+        if (!ReadFileBytes(path, bytes))
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::DECODE_FAILED " << path << std::endl;
+            return -1;
+        }
+        const ImageProbe probe = ProbeImage(bytes.data(), bytes.size());
+        if (!probe.valid())
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::DECODE_FAILED " << path << std::endl;
+            return -1;
+        }
+        if (!fits(probe.width, probe.height))
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::IMAGE_TOO_BIG " << probe.width << "x" << probe.height << std::endl;
+            return -1;
+        }
+        ImageDecodeOptions options;
+        options.flipVertically = flipY;
+        options.desiredChannels = 4;
+        Image image{ probe.width, probe.height, std::vector<unsigned char>(probe.decodedSize(4)) };
+        int width, height, channels;
+        if (!decoder.decodeInto(bytes.data(), bytes.size(), options, image.pixels.data(), image.pixels.size(),
+                                &width, &height, &channels))
+        {
+            std::cout << "ERROR::TEXTURE_ATLAS::DECODE_FAILED " << path << std::endl;
+            return -1;
+        }
+        images.push_back(std::move(image));
+        return (int)images.size() - 1;
+    }
+
+    // pack everything added so far and build the levels. False if an image is bigger than a page.
+    bool build()
+    {
+        // every image is decoded by now, the scratch isn't needed until the next add
+        decoder.trim();
+        // tallest first packs a skyline tightest
+        std::vector<int> order(images.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [this](int a, int b)
+        {
+            return images[a].height != images[b].height ? images[a].height > images[b].height
+                                                        : images[a].width > images[b].width;
+        });
+
+        std::vector<SkylinePacker> pages;
+        std::vector<AtlasRect> slots(images.size());
+        std::vector<int> slotPages(images.size());
+        packed.assign(images.size(), AtlasEntry{});
+        for (int index : order)
+        {
+            const Image& image = images[index];
+            const int slotWidth = alignUp(image.width + 2 * gutter);
+            const int slotHeight = alignUp(image.height + 2 * gutter);
+            if (!fits(image.width, image.height))
+            {
+                std::cout << "ERROR::TEXTURE_ATLAS::IMAGE_TOO_BIG " << image.width << "x" << image.height << std::endl;
+                return false;
+            }
+            // earlier pages first, they may still have holes for the smaller images
+            size_t page = 0;
+            while (page < pages.size() && !pages[page].insert(slotWidth, slotHeight, slots[index]))
+                page++;
+            if (page == pages.size())
+            {
+                pages.emplace_back(size, size);
+                pages.back().insert(slotWidth, slotHeight, slots[index]);
+            }
+            slotPages[index] = (int)page;
+            const AtlasRect& slot = slots[index];
+            packed[index] = AtlasEntry{ { (float)(slot.x + gutter) / size, (float)(slot.y + gutter) / size },
+                                        { (float)image.width / size, (float)image.height / size }, (float)page };
+        }
+        layers = std::max<int>((int)pages.size(), 1);
+        occupancy = 0.0f;
+        for (const auto& page : pages)
+            occupancy += page.occupancy() / pages.size();
+
+        const size_t pageBytes = (size_t)size * size * 4;
+        levelPixels.assign(levels, {});
+        levelPixels[0].assign(pageBytes * layers, 0);
+        for (size_t i = 0; i < images.size(); i++)
+            blit(images[i], slots[i], levelPixels[0].data() + pageBytes * slotPages[i]);
+        for (int level = 1, extent = MipExtent(size); level < levels; level++, extent = MipExtent(extent))
+            levelPixels[level].resize((size_t)extent * extent * 4 * layers);
+        MipChainBuilder mipBuilder(4, mipmaps);
+        for (int layer = 0; layer < layers; layer++)
+        {
+            const std::vector<MipLevel> mips = mipBuilder.build(levelPixels[0].data() + pageBytes * layer, size, size, levels);
+            for (int level = 1; level < levels; level++)
+            {
+                const std::vector<unsigned char>& mip = mips[level - 1].pixels;
+                memcpy(levelPixels[level].data() + mip.size() * layer, mip.data(), mip.size());
+            }
+        }
+        return true;
+    }
+
+    // after build()
+    const std::vector<AtlasEntry>& entries() const { return packed; }
+    int pageSize() const { return size; }
+    int layerCount() const { return layers; }
+    int levelCount() const { return levels; }
+    float pageOccupancy() const { return occupancy; }
+
+    // a GL_TEXTURE_2D_ARRAY with the pages as layers, 0 on failure
+    unsigned int upload() const
+    {
+        std::vector<const unsigned char*> data;
+        for (const auto& level : levelPixels)
+            data.push_back(level.data());
+        return UploadTextureAtlas(size, layers, data);
+    }
+
+    // the pages, levels and entries as an .atlas file for LoadTextureAtlas
+    bool write(const char* path) const
+    {
+        const TextureAtlasHeader header{ TEXTURE_ATLAS_MAGIC, TEXTURE_ATLAS_VERSION, (uint32_t)size, (uint32_t)layers,
+                                         (uint32_t)levels, (uint32_t)packed.size() };
+        const std::vector<uint64_t> offsets = TextureAtlasLevelOffsets(header.pageSize, header.layerCount,
+                                                                       header.levelCount, header.entryCount);
+        // write next to the final name and rename, so a failed build never leaves half a file
+        const std::filesystem::path target = path;
+        auto temporary = target;
+        temporary += ".tmp";
+        {
+            std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char*>(packed.data()), sizeof(AtlasEntry) * packed.size());
+            for (int level = 0; level < levels; level++)
+            {
+                const char padding[TEXTURE_ATLAS_ALIGNMENT] = {};
+                file.write(padding, (std::streamsize)(offsets[level] - (uint64_t)file.tellp()));
+                file.write(reinterpret_cast<const char*>(levelPixels[level].data()), levelPixels[level].size());
+            }
+            if (!file)
+            {
+                std::cout << "ERROR::TEXTURE_ATLAS::WRITE_FAILED " << temporary.string() << std::endl;
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporary, target, error);
+        return !error;
+    }
+
+private:
+    struct Image
+    {
+        int width, height;
+        std::vector<unsigned char> pixels; // RGBA
+    };
+
+    int size;
+    int gutter;
+    int alignment;
+    int levels;
+    int layers = 0;
+    float occupancy = 0.0f;
+    MipmapOptions mipmaps;
+    std::vector<Image> images;
+    std::vector<AtlasEntry> packed;
+    std::vector<std::vector<unsigned char>> levelPixels;
+
+    ImageDecoder decoder;
+
+    int alignUp(int extent) const
+    {
+        return (extent + alignment - 1) / alignment * alignment;
+    }
+
+    // the slot, gutter included, on one page
+    bool fits(int width, int height) const
+    {
+        return alignUp(width + 2 * gutter) <= size && alignUp(height + 2 * gutter) <= size;
+    }
+
+    // the image into the middle of its slot, every texel of the slot around it repeats the
+    // nearest edge texel
+    void blit(const Image& image, const AtlasRect& slot, unsigned char* page) const
+    {
+        for (int y = 0; y < slot.height; y++)
+        {
+            const int sourceY = std::clamp(y - gutter, 0, image.height - 1);
+            const unsigned char* source = image.pixels.data() + (size_t)sourceY * image.width * 4;
+            unsigned char* row = page + ((size_t)(slot.y + y) * size + slot.x) * 4;
+            for (int x = 0; x < gutter; x++)
+                memcpy(row + x * 4, source, 4);
+            memcpy(row + gutter * 4, source, (size_t)image.width * 4);
+            for (int x = gutter + image.width; x < slot.width; x++)
+                memcpy(row + x * 4, source + (size_t)(image.width - 1) * 4, 4);
+        }
+    }
+};
+
+// An atlas written by TextureAtlasBuilder::write, uploaded from the mapping. texture is 0 if the
+// file is missing or damaged. The entries are in the order the images were added.
+struct TextureAtlas
+{
+    unsigned int texture = 0; // GL_TEXTURE_2D_ARRAY
+    int layerCount = 0;
+    std::vector<AtlasEntry> entries;
+};
+
+inline TextureAtlas LoadTextureAtlas(const char* path)
+{
+    TextureAtlas atlas;
+    const MappedFile file(path);
+    if (!file.valid() || file.size() < sizeof(TextureAtlasHeader))
+        return atlas;
+    TextureAtlasHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != TEXTURE_ATLAS_MAGIC || header.version != TEXTURE_ATLAS_VERSION || header.pageSize == 0 ||
+        header.pageSize > 16384 || header.levelCount == 0 || header.levelCount > 15 || header.layerCount == 0 ||
+        header.layerCount > 2048 || header.entryCount > (1u << 24))
+    {
+        std::cout << "ERROR::TEXTURE_ATLAS::INVALID " << path << std::endl;
+        return atlas;
+    }
+    const std::vector<uint64_t> offsets = TextureAtlasLevelOffsets(header.pageSize, header.layerCount,
+                                                                   header.levelCount, header.entryCount);
+    if (file.size() < offsets.back())
+    {
+        std::cout << "ERROR::TEXTURE_ATLAS::INVALID " << path << std::endl;
+        return atlas;
+    }
+    atlas.entries.resize(header.entryCount);
+    memcpy(atlas.entries.data(), file.data() + sizeof(header), sizeof(AtlasEntry) * atlas.entries.size());
+    std::vector<const unsigned char*> levels;
+    for (uint32_t level = 0; level < header.levelCount; level++)
+        levels.push_back(file.data() + offsets[level]);
+    atlas.texture = UploadTextureAtlas((int)header.pageSize, (int)header.layerCount, levels);
+    atlas.layerCount = (int)header.layerCount;
+    return atlas;
+}
+
+// Point the instance attributes of vertex_atlas.vert at an array of AtlasEntry in buffer: the
+// UV transform at firstAttribute, the layer right after it, one entry per instance.
+inline void AttachAtlasInstances(GLuint vertexArray, GLuint buffer, GLintptr offset = 0, GLuint firstAttribute = 7)
+{
+    glState.bindVertexArray(vertexArray);
+    glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+    glEnableVertexAttribArray(firstAttribute);
+    glVertexAttribPointer(firstAttribute, 4, GL_FLOAT, GL_FALSE, sizeof(AtlasEntry), (void*)offset);
+    glVertexAttribDivisor(firstAttribute, 1);
+    glEnableVertexAttribArray(firstAttribute + 1);
+    glVertexAttribPointer(firstAttribute + 1, 1, GL_FLOAT, GL_FALSE, sizeof(AtlasEntry),
+                          (void*)(offset + offsetof(AtlasEntry, layer)));
+    glVertexAttribDivisor(firstAttribute + 1, 1);
+}
+
+#endif
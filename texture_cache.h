@@ -0,0 +1,312 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+#include "texture.h"
+#include "texture_container.h"
+#include "compressed_texture.h"
+#include "mipmap.h"
+#include "texture_loader.h"
+#include "image_probe.h"
+#include "job_system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Owns textures and keeps their memory under a budget. Every texture remembers where it came
+// from (a .tex container or an image file) and what each mip level costs. When the resident
+// total goes over the budget, the textures bound longest ago lose their big levels: those are
+// respecified as 0x0, which releases them, and GL_TEXTURE_BASE_LEVEL moves down to a small mip
+// that stays resident, so the texture keeps working with the same GL name. Binding an evicted
+// texture streams the big levels back in from the source. Reading and decoding happen on the
+// workers of an AsyncTextureLoader, whose per-frame upload budget and upload buffer also pace
+// the stream-ins.
+//
+// The byte counts are what the texel data takes, drivers may pad (3 channel formats usually
+// end up 4 channel), so treat the budget as approximate. GL thread only.
+class TextureCache
+{
+public:
+    struct Stats
+    {
+        uint32_t evictions = 0;
+        uint32_t streamIns = 0;
+        size_t evictedBytes = 0;
+        size_t streamedBytes = 0;
+    };
+
+    // lowMipSize: evicted textures keep the levels no bigger than this on either side
+    TextureCache(JobSystem& jobs, size_t budgetBytes, int lowMipSize = 64, const MipmapOptions& mipmapOptions = MipmapOptions{},
+                 size_t uploadBytesPerFrame = 8 << 20)
+        : loader(jobs, uploadBytesPerFrame, mipmapOptions), budget(budgetBytes), lowMipSize(lowMipSize)
+    {
+        compress = loader.compresses();
+    }
+
+    ~TextureCache()
+    {
+        release();
+    }
+
+    TextureCache(const TextureCache&) = delete;
+    TextureCache& operator=(const TextureCache&) = delete;
+
+    // A texture from containerPath when given and usable (uploaded from the mapping right
+    // away), from imagePath otherwise, decoded on a worker with a white placeholder until then.
+    // The name stays valid until the cache goes away.
+    unsigned int load(const char* imagePath, bool flipY = false, const char* containerPath = nullptr)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+        SetDefaultTextureParameters();
+
+        Entry& entry = entries[texture];
+        entry.imagePath = imagePath;
+        entry.flipY = flipY;
+        entry.lastUsed = frame;
+        if (containerPath && uploadContainer(entry, containerPath))
+            return texture;
+
+        // a single level is mip complete, so the placeholder samples fine with the mipmap filter
+        const unsigned char placeholder[4] = { 255, 255, 255, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        // an image the header already rules out keeps the placeholder, no worker reads it
+        if (images.add(imagePath).valid())
+            requestStreamIn(texture, entry);
+        return texture;
+    }
+
+    // note a use this frame, streaming the full texture back in if it was evicted
+    void touch(unsigned int texture)
+    {
+        auto found = entries.find(texture);
+        if (found == entries.end())
+            return;
+        Entry& entry = found->second;
+        entry.lastUsed = frame;
+        if (entry.baseLevel > 0 && !entry.streaming)
+            requestStreamIn(texture, entry);
+    }
+
+    void bind(GLuint unit, unsigned int texture)
+    {
+        touch(texture);
+        glState.bindTexture(unit, GL_TEXTURE_2D, texture);
+    }
+
+    // once per frame on the GL thread: upload what the stream-ins have ready, within the
+    // loader's budget, then evict down to the budget
+    void update()
+    {
+        current = Stats{};
+        loader.update();
+        Streamed streamed;
+        while (loader.popStreamed(streamed))
+            finishStreamIn(streamed);
+        enforceBudget();
+        previous = current;
+        total.evictions += current.evictions;
+        total.streamIns += current.streamIns;
+        total.evictedBytes += current.evictedBytes;
+        total.streamedBytes += current.streamedBytes;
+        frame++;
+    }
+
+    // block until every stream-in is uploaded
+    void finish()
+    {
+        loader.finish();
+        update();
+    }
+
+    // Delete every texture, the names are invalid afterwards. Needs the context, so call it
+    // before the context goes away when the cache outlives it.
+    void release()
+    {
+        // a stream-in still uploading would bring a deleted name back
+        loader.finish();
+        for (const auto& [texture, entry] : entries)
+            glState.deleteTexture(texture);
+        entries.clear();
+        resident = 0;
+    }
+
+    void setBudget(size_t bytes) { budget = bytes; }
+    size_t budgetBytes() const { return budget; }
+    size_t residentBytes() const { return resident; }
+    size_t textureCount() const { return entries.size(); }
+    // the headers of every image loaded from, probed once per path
+    const ImageIndex& imageIndex() const { return images; }
+    const Stats& lastFrame() const { return previous; }
+    const Stats& totals() const { return total; }
+    // time from a texture being needed to its levels being uploaded
+    double averageStreamInMilliseconds() const { return streamInCount ? streamInMilliseconds / streamInCount : 0.0; }
+    double maxStreamInMilliseconds() const { return streamInMax; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry
+    {
+        std::string imagePath;
+        std::string containerPath; // empty when the texture came from the image
+        bool flipY = false;
+        GLenum internalFormat = 0, format = 0, type = 0; // format 0 for compressed blocks
+        std::vector<size_t> levelBytes; // empty until the first stream-in
+        int baseLevel = 0;              // levels below are not resident
+        int evictLevel = 0;             // the level eviction drops down to
+        uint64_t lastUsed = 0;
+        bool streaming = false;
+        Clock::time_point requested;
+    };
+
+    using Streamed = AsyncTextureLoader::StreamedTexture;
+
+    AsyncTextureLoader loader;
+    size_t budget;
+    int lowMipSize;
+    bool compress = false;
+    std::unordered_map<unsigned int, Entry> entries;
+    ImageIndex images;
+    size_t resident = 0;
+    uint64_t frame = 1;
+    Stats current, previous, total;
+    double streamInMilliseconds = 0.0, streamInMax = 0.0;
+    uint32_t streamInCount = 0;
+
+    static size_t Sum(const std::vector<size_t>& bytes, int begin, int end)
+    {
+        size_t sum = 0;
+        for (int i = begin; i < end; i++)
+            sum += bytes[i];
+        return sum;
+    }
+
+    int chooseEvictLevel(const std::vector<int>& widths, const std::vector<int>& heights) const
+    {
+        int level = 0;
+        while (level + 1 < (int)widths.size() && std::max(widths[level], heights[level]) > lowMipSize)
+            level++;
+        return level;
+    }
+
+    bool uploadContainer(Entry& entry, const char* path)
+    {
+        const MappedFile file(path);
+        TextureContainerHeader header;
+        std::vector<TextureContainerLevel> table;
+        if (!ParseTextureContainer(file, path, header, table) || (header.format == 0 && !compress))
+            return false;
+        entry.containerPath = path;
+        entry.internalFormat = header.internalFormat;
+        entry.format = header.format;
+        entry.type = header.type;
+        std::vector<int> widths, heights;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)table.size() - 1);
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            const TextureContainerLevel& level = table[i];
+            UploadTextureLevel(GL_TEXTURE_2D, (GLint)i, header.internalFormat, header.format, header.type,
+                               level.width, level.height, file.data() + level.offset, (size_t)level.size);
+            entry.levelBytes.push_back((size_t)level.size);
+            widths.push_back(level.width);
+            heights.push_back(level.height);
+        }
+        entry.evictLevel = chooseEvictLevel(widths, heights);
+        resident += Sum(entry.levelBytes, 0, (int)entry.levelBytes.size());
+        return true;
+    }
+
+    void requestStreamIn(unsigned int texture, Entry& entry)
+    {
+        entry.streaming = true;
+        entry.requested = Clock::now();
+        // the first load wants every level, later ones only those above the resident base
+        loader.stream(texture, entry.imagePath, entry.flipY, entry.containerPath, entry.levelBytes.empty() ? -1 : entry.baseLevel);
+    }
+
+    // the loader has uploaded the levels and moved the base down, only the books are left
+    void finishStreamIn(const Streamed& streamed)
+    {
+        auto found = entries.find(streamed.texture);
+        if (found == entries.end())
+            return;
+        Entry& entry = found->second;
+        entry.streaming = false;
+        if (streamed.levelBytes.empty())
+            return;
+
+        const bool first = entry.levelBytes.empty();
+        if (first)
+        {
+            entry.internalFormat = streamed.internalFormat;
+            entry.format = streamed.format;
+            entry.type = streamed.type;
+            entry.levelBytes = streamed.levelBytes;
+            entry.evictLevel = chooseEvictLevel(streamed.widths, streamed.heights);
+            entry.baseLevel = (int)streamed.levelBytes.size();
+        }
+        const size_t bytes = Sum(entry.levelBytes, 0, entry.baseLevel);
+        resident += bytes;
+        entry.baseLevel = 0;
+
+        if (!first)
+        {
+            const double milliseconds = std::chrono::duration<double, std::milli>(Clock::now() - entry.requested).count();
+            streamInMilliseconds += milliseconds;
+            streamInMax = std::max(streamInMax, milliseconds);
+            streamInCount++;
+            current.streamIns++;
+            current.streamedBytes += bytes;
+        }
+    }
+
+    // drop the levels above evictLevel, the memory goes once the levels are 0x0
+    void evict(unsigned int texture, Entry& entry)
+    {
+        glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.evictLevel);
+        for (int i = 0; i < entry.evictLevel; i++)
+        {
+            if (entry.format == 0)
+                glCompressedTexImage2D(GL_TEXTURE_2D, i, entry.internalFormat, 0, 0, 0, 0, nullptr);
+            else
+                glTexImage2D(GL_TEXTURE_2D, i, (GLint)entry.internalFormat, 0, 0, 0, entry.format, entry.type, nullptr);
+        }
+        const size_t bytes = Sum(entry.levelBytes, 0, entry.evictLevel);
+        resident -= bytes;
+        entry.baseLevel = entry.evictLevel;
+        current.evictions++;
+        current.evictedBytes += bytes;
+    }
+
+    // least recently used first, never what the last frame drew or what is being streamed
+    void enforceBudget()
+    {
+        if (resident <= budget)
+            return;
+        std::vector<std::pair<uint64_t, unsigned int>> candidates;
+        for (auto& [texture, entry] : entries)
+        {
+            if (!entry.streaming && entry.baseLevel < entry.evictLevel && entry.lastUsed + 1 < frame)
+                candidates.emplace_back(entry.lastUsed, texture);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        for (const auto& candidate : candidates)
+        {
+            if (resident <= budget)
+                break;
+            evict(candidate.second, entries[candidate.second]);
+        }
+    }
+};
+
+#endif
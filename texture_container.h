@@ -0,0 +1,206 @@
+#ifndef TEXTURE_CONTAINER_H
+#define TEXTURE_CONTAINER_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+#include "texture.h"
+#include "image_decode.h"
+#include "mipmap.h"
+#include "compressed_texture.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// .tex, a container for texel data that is ready to upload: already flipped, every mip level
+// present, optionally S3TC blocks. A header and a level table are followed by the levels, each
+// aligned to TEXTURE_CONTAINER_ALIGNMENT. LoadTextureContainer maps the file and hands the
+// level pointers straight to glTexImage2D/glCompressedTexImage2D, so startup does no decoding
+// and no copies of its own. Converted with --convert, see test.cpp.
+
+struct TextureContainerHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t internalFormat; // sized or GL_COMPRESSED_* format
+    uint32_t format;         // client format for glTexImage2D, 0 for compressed data
+    uint32_t type;           // client type for glTexImage2D, 0 for compressed data
+    uint32_t levelCount;
+    int32_t width;
+    int32_t height;
+};
+struct TextureContainerLevel
+{
+    uint64_t offset; // from the start of the file
+    uint64_t size;
+    int32_t width;
+    int32_t height;
+};
+constexpr uint32_t TEXTURE_CONTAINER_MAGIC = 0x43584554; // "TEXC"
+constexpr uint32_t TEXTURE_CONTAINER_VERSION = 1;
+constexpr uint64_t TEXTURE_CONTAINER_ALIGNMENT = 16;
+
+// the levels to write, data points at tightly packed rows or blocks
+struct TextureContainerSource
+{
+    int width;
+    int height;
+    const void* data;
+    size_t size;
+};
+
+inline bool WriteTextureContainer(const char* path, GLenum internalFormat, GLenum format, GLenum type,
+                                  const std::vector<TextureContainerSource>& levels)
+{
+    if (levels.empty())
+        return false;
+    const TextureContainerHeader header{ TEXTURE_CONTAINER_MAGIC, TEXTURE_CONTAINER_VERSION, internalFormat, format, type,
+                                         (uint32_t)levels.size(), levels[0].width, levels[0].height };
+    std::vector<TextureContainerLevel> table(levels.size());
+    uint64_t offset = sizeof(header) + sizeof(TextureContainerLevel) * levels.size();
+    for (size_t i = 0; i < levels.size(); i++)
+    {
+        offset = (offset + TEXTURE_CONTAINER_ALIGNMENT - 1) & ~(TEXTURE_CONTAINER_ALIGNMENT - 1);
+        table[i] = TextureContainerLevel{ offset, levels[i].size, levels[i].width, levels[i].height };
+        offset += levels[i].size;
+    }
+
+    // write next to the final name and rename, so a failed conversion never leaves half a file
+    const std::filesystem::path target = path;
+    auto temporary = target;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::TEXTURE_CONTAINER::WRITE_FAILED " << temporary.string() << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(table.data()), sizeof(TextureContainerLevel) * table.size());
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            const char padding[TEXTURE_CONTAINER_ALIGNMENT] = {};
+            file.write(padding, (std::streamsize)(table[i].offset - (uint64_t)file.tellp()));
+            file.write(static_cast<const char*>(levels[i].data), levels[i].size);
+        }
+        if (!file)
+        {
+            std::cout << "ERROR::TEXTURE_CONTAINER::WRITE_FAILED " << temporary.string() << std::endl;
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, target, error);
+    return !error;
+}
+
+// decode an image file, flip it if asked, build the mip chain, optionally compress it and write
+// it all as a container. Needs no GL context.
+inline bool ConvertToTextureContainer(const char* input, const char* output, bool flipY, bool compress,
+                                      const MipmapOptions& mipmaps = MipmapOptions{})
+{
+    std::vector<unsigned char> bytes;
+    if (!ReadFileBytes(input, bytes))
+    {
+        std::cout << "ERROR::TEXTURE_CONTAINER::READ_FAILED " << input << std::endl;
+        return false;
+    }
+    ImageDecodeOptions options;
+    options.flipVertically = flipY;
+    int width, height, channels;
+    unsigned char* pixels = DecodeImage(bytes.data(), bytes.size(), options, &width, &height, &channels);
+    if (!pixels)
+    {
+        std::cout << "ERROR::TEXTURE_CONTAINER::DECODE_FAILED " << input << std::endl;
+        return false;
+    }
+    const std::vector<MipLevel> mips = BuildMipChain(pixels, width, height, channels, mipmaps);
+
+    bool written;
+    if (compress)
+    {
+        const CompressedTexture texture = CompressTexture(pixels, width, height, channels, mips);
+        std::vector<TextureContainerSource> levels;
+        for (const auto& level : texture.levels)
+            levels.push_back(TextureContainerSource{ level.width, level.height, level.blocks.data(), level.blocks.size() });
+        written = WriteTextureContainer(output, texture.internalFormat, 0, 0, levels);
+    }
+    else
+    {
+        std::vector<TextureContainerSource> levels;
+        levels.push_back(TextureContainerSource{ width, height, pixels, (size_t)width * height * channels });
+        for (const auto& level : mips)
+            levels.push_back(TextureContainerSource{ level.width, level.height, level.pixels.data(), level.pixels.size() });
+        written = WriteTextureContainer(output, InternalFormatForChannels(channels), PixelFormatForChannels(channels),
+                                        GL_UNSIGNED_BYTE, levels);
+    }
+    stbi_image_free(pixels);
+    return written;
+}
+
+// Check a mapped container and read its header and level table. False, with an error, if the
+// file is not a container or its table points outside the file.
+inline bool ParseTextureContainer(const MappedFile& file, const char* path, TextureContainerHeader& header,
+                                  std::vector<TextureContainerLevel>& table)
+{
+    if (!file.valid() || file.size() < sizeof(TextureContainerHeader))
+        return false;
+    memcpy(&header, file.data(), sizeof(header));
+    const size_t tableEnd = sizeof(header) + sizeof(TextureContainerLevel) * (size_t)header.levelCount;
+    if (header.magic != TEXTURE_CONTAINER_MAGIC || header.version != TEXTURE_CONTAINER_VERSION ||
+        header.levelCount == 0 || header.levelCount > 32 || file.size() < tableEnd)
+    {
+        std::cout << "ERROR::TEXTURE_CONTAINER::INVALID " << path << std::endl;
+        return false;
+    }
+    table.resize(header.levelCount);
+    memcpy(table.data(), file.data() + sizeof(header), sizeof(TextureContainerLevel) * table.size());
+    const bool compressed = header.format == 0;
+    const uint64_t texelBytes = header.format == GL_RED ? 1 : header.format == GL_RG ? 2 : header.format == GL_RGB ? 3 : 4;
+    for (const auto& level : table)
+    {
+        // glTexImage2D reads width * height texels whatever the table says
+        const bool tooSmall = !compressed && level.size < (uint64_t)level.width * level.height * texelBytes;
+        if (level.offset > file.size() || level.size > file.size() - level.offset || level.width <= 0 || level.height <= 0 || tooSmall)
+        {
+            std::cout << "ERROR::TEXTURE_CONTAINER::INVALID " << path << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// A texture from a container, uploaded straight out of the mapping. Returns 0 if the file is
+// missing or damaged, or holds S3TC blocks the driver can't take, so the caller can fall back
+// to the source image.
+inline unsigned int LoadTextureContainer(const char* path)
+{
+    const MappedFile file(path);
+    TextureContainerHeader header;
+    std::vector<TextureContainerLevel> table;
+    if (!ParseTextureContainer(file, path, header, table))
+        return 0;
+    if (header.format == 0 && !BlockCompressionSupported())
+        return 0;
+
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+    SetDefaultTextureParameters();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)header.levelCount - 1);
+    for (uint32_t i = 0; i < header.levelCount; i++)
+    {
+        const TextureContainerLevel& level = table[i];
+        UploadTextureLevel(GL_TEXTURE_2D, (GLint)i, header.internalFormat, header.format, header.type,
+                           level.width, level.height, file.data() + level.offset, (size_t)level.size);
+    }
+    return texture;
+}
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include "gl_state.h"
+#include "texture.h"
+#include "texture_container.h"
+#include "job_system.h"
+#include "concurrent_queue.h"
+#include "image_decode.h"
+#include "image_probe.h"
+#include "pixel_upload.h"
+#include "mipmap.h"
+#include "compressed_texture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads textures without blocking the GL thread. load() hands back a texture name right away,
+// showing a 1x1 placeholder, while a worker reads and decodes the file. The decoded pixels come
+// back through a lock-free queue and update() uploads at most uploadBytesPerFrame of them per
+// frame, in row bands for big images, so a burst of loads never turns into a hitch. The bands
+// go through a PixelUploadBuffer: a worker copies them into the mapped buffer and the GL thread
+// only issues the upload from it. The mip chain is built on the worker too, right after
+// decoding, and its levels go through the same bands ahead of level 0, smallest first, so the
+// texture never samples a level that is not there yet. Where the driver has S3TC the worker
+// instead produces (or reads back from the disk cache) BC1/BC3 blocks, which go up a whole
+// level at a time since they are a fraction of the size.
+//
+// stream() does the same for a texture someone else owns, from an image or a .tex container,
+// and reports back through popStreamed() once the levels are in. TextureCache uses it to bring
+// evicted levels back.
+class AsyncTextureLoader
+{
+public:
+    // what a stream() ended up uploading, levelBytes is empty if the source could not be read
+    struct StreamedTexture
+    {
+        unsigned int texture = 0;
+        GLenum internalFormat = 0, format = 0, type = 0; // format 0 for compressed blocks
+        std::vector<int> widths, heights;
+        std::vector<size_t> levelBytes;
+    };
+
+    AsyncTextureLoader(JobSystem& jobs, size_t uploadBytesPerFrame = 8 << 20,
+                       const MipmapOptions& mipmapOptions = MipmapOptions{}, bool blockCompress = true)
+        : jobs(jobs), uploadBytesPerFrame(uploadBytesPerFrame), mipmapOptions(mipmapOptions)
+    {
+        // without the extension textures stay uncompressed
+        compress = blockCompress && BlockCompressionSupported();
+    }
+
+    ~AsyncTextureLoader()
+    {
+        // the decode jobs push into our queue and wait while it is full, so it has to keep
+        // draining until the last of them is done, as does a band still being copied
+        DecodedImage image;
+        while (decodesInFlight.load(std::memory_order_acquire) > 0 || (bandRows > 0 && !bandFilled.load(std::memory_order_acquire)))
+        {
+            // the levels go with the image
+            while (decoded.tryPop(image))
+                image = DecodedImage{};
+            std::this_thread::yield();
+        }
+    }
+
+    AsyncTextureLoader(const AsyncTextureLoader&) = delete;
+    AsyncTextureLoader& operator=(const AsyncTextureLoader&) = delete;
+
+    unsigned int load(const char* fileName, const bool flipY = false)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glState.bindTextureForUpdate(GL_TEXTURE_2D, texture);
+        SetDefaultTextureParameters();
+        // a single level is mip complete, so the placeholder samples fine with the mipmap filter
+        const unsigned char placeholder[4] = { 255, 255, 255, 255 };
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+        request(texture, fileName, flipY, std::string(), -1, false);
+        return texture;
+    }
+
+    // Levels [0, levelCount) of texture from containerPath when given, from imagePath otherwise.
+    // levelCount -1 means the whole chain into a texture showing a single level placeholder;
+    // otherwise the levels from levelCount down must already be resident, with
+    // GL_TEXTURE_BASE_LEVEL at levelCount, and the base moves down as each level lands.
+    void stream(unsigned int texture, const std::string& imagePath, bool flipY, const std::string& containerPath, int levelCount)
+    {
+        request(texture, imagePath, flipY, containerPath, levelCount, true);
+    }
+
+    // the next stream() that finished uploading, GL thread
+    bool popStreamed(StreamedTexture& streamed)
+    {
+        if (streamedTextures.empty())
+            return false;
+        streamed = std::move(streamedTextures.front());
+        streamedTextures.pop_front();
+        return true;
+    }
+
+    // upload what the workers finished, call once per frame on the GL thread
+    void update()
+    {
+        upload(uploadBytesPerFrame);
+    }
+
+    // block until every texture requested so far is uploaded
+    void finish()
+    {
+        while (pending > 0)
+        {
+            upload((size_t)-1);
+            if (pending > 0)
+                std::this_thread::yield();
+        }
+    }
+
+    size_t pendingCount() const { return pending; }
+    bool compresses() const { return compress; }
+
+private:
+    // scratch each worker keeps between images, every worker holds its own
+    static constexpr size_t WORKER_SCRATCH_BYTES = 16u << 20;
+
+    struct DecodedImage
+    {
+        unsigned int texture = 0;
+        int levelCount = -1; // as passed to stream()
+        bool report = false;
+        GLenum internalFormat = 0, format = 0, type = 0; // format 0 for compressed blocks
+        std::vector<MipLevel> levels; // level 0 first, blocks instead of pixels when compressed; empty if reading failed
+        std::string path;
+    };
+
+    JobSystem& jobs;
+    size_t uploadBytesPerFrame;
+    MipmapOptions mipmapOptions;
+    bool compress = false;
+    ConcurrentQueue<DecodedImage> decoded{ 256 };
+    // moved out of the queue every upload, a worker waiting on a full queue would hold up the
+    // band copies queued behind it
+    std::deque<DecodedImage> ready;
+    std::deque<StreamedTexture> streamedTextures;
+    // the image being uploaded, the level and the next row of it, big images take several frames
+    DecodedImage current;
+    int level = 0;
+    int nextRow = 0;
+    bool levelStarted = false;
+    // rows of current being copied into the upload buffer by a worker
+    PixelUploadBuffer pixelBuffer;
+    PixelUploadRegion band;
+    int bandRows = 0;
+    std::atomic<bool> bandFilled{ false };
+    size_t pending = 0;
+    std::atomic<size_t> decodesInFlight{ 0 };
+
+    void request(unsigned int texture, const std::string& imagePath, bool flipY, const std::string& containerPath,
+                 int levelCount, bool report)
+    {
+        pending++;
+        decodesInFlight.fetch_add(1, std::memory_order_relaxed);
+
+        jobs.submit([this, texture, imagePath, flipY, containerPath, levelCount, report]
+        {
+            DecodedImage image;
+            if (containerPath.empty())
+            {
+                image.path = imagePath;
+                readImage(image, flipY);
+            }
+            else
+            {
+                image.path = containerPath;
+                ReadContainer(image);
+            }
+            // a stream-in only wants the levels above the resident ones
+            if (levelCount >= 0 && (int)image.levels.size() > levelCount)
+                image.levels.resize(levelCount);
+            image.texture = texture;
+            image.levelCount = levelCount;
+            image.report = report;
+            // the GL thread drains the queue every frame, so a full queue only means waiting a bit
+            while (!decoded.tryPush(image))
+                std::this_thread::yield();
+            // the last touch of the loader, the destructor may go ahead after this
+            decodesInFlight.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    void readImage(DecodedImage& image, bool flipY) const
+    {
+        std::vector<unsigned char> bytes;
+        if (!ReadFileBytes(image.path.c_str(), bytes))
+            return;
+        if (compress)
+        {
+            // after the first run this comes out of the disk cache, no decoding
+            CompressedTexture compressed;
+            if (!LoadOrCompressTexture(bytes, flipY, mipmapOptions, compressed))
+                return;
+            image.internalFormat = compressed.internalFormat;
+            for (auto& blocks : compressed.levels)
+                image.levels.push_back(MipLevel{ blocks.width, blocks.height, std::move(blocks.blocks) });
+            return;
+        }
+
+        // straight into level 0, with each worker's scratch kept from one image to the next
+        static thread_local ImageDecoder decoder(WORKER_SCRATCH_BYTES);
+        ImageDecodeOptions options;
+        options.flipVertically = flipY;
+        const ImageProbe probe = ProbeImage(bytes.data(), bytes.size());
+        const size_t size = probe.decodedSize(options.desiredChannels);
+        std::vector<unsigned char> pixels(size);
+        int width, height, channels;
+        if (!probe.valid() || !decoder.decodeInto(bytes.data(), bytes.size(), options, pixels.data(), size, &width, &height, &channels))
+            return;
+        std::vector<MipLevel> mips = BuildMipChain(pixels.data(), width, height, channels, mipmapOptions);
+        image.internalFormat = InternalFormatForChannels(channels);
+        image.format = PixelFormatForChannels(channels);
+        image.type = GL_UNSIGNED_BYTE;
+        image.levels.push_back(MipLevel{ width, height, std::move(pixels) });
+        for (auto& mip : mips)
+            image.levels.push_back(std::move(mip));
+    }
+
+    static void ReadContainer(DecodedImage& image)
+    {
+        const MappedFile file(image.path.c_str());
+        TextureContainerHeader header;
+        std::vector<TextureContainerLevel> table;
+        if (!ParseTextureContainer(file, image.path.c_str(), header, table))
+            return;
+        image.internalFormat = header.internalFormat;
+        image.format = header.format;
+        image.type = header.type;
+        for (const TextureContainerLevel& level : table)
+        {
+            image.levels.push_back(MipLevel{ level.width, level.height,
+                                             std::vector<unsigned char>(file.data() + level.offset, file.data() + level.offset + level.size) });
+        }
+    }
+
+    // Before the first row of a level lands. Level 0 replaces the placeholder once the rest
+    // of the chain is in; while its rows are uploading the texture samples from level 1
+    // down, which is complete by then, so the texture never shows half a level.
+    void startLevel()
+    {
+        const MipLevel& mip = current.levels[level];
+        glState.bindTextureForUpdate(GL_TEXTURE_2D, current.texture);
+        if (current.levelCount < 0 && level == 0)
+        {
+            const int last = (int)current.levels.size() - 1;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, last > 0 ? 1 : 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, last);
+        }
+        if (current.format != 0)
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, (GLint)current.internalFormat, mip.width, mip.height, 0,
+                         current.format, current.type, nullptr);
+        }
+    }
+
+    // after the last row, the level becomes the base unless the placeholder is still showing
+    void finishLevel()
+    {
+        if (current.levelCount >= 0 || level == 0)
+        {
+            glState.bindTextureForUpdate(GL_TEXTURE_2D, current.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        }
+        levelStarted = false;
+        nextRow = 0;
+    }
+
+    void finishImage()
+    {
+        if (current.report)
+        {
+            StreamedTexture streamed;
+            streamed.texture = current.texture;
+            streamed.internalFormat = current.internalFormat;
+            streamed.format = current.format;
+            streamed.type = current.type;
+            for (const MipLevel& mip : current.levels)
+            {
+                streamed.widths.push_back(mip.width);
+                streamed.heights.push_back(mip.height);
+                streamed.levelBytes.push_back(mip.pixels.size());
+            }
+            streamedTextures.push_back(std::move(streamed));
+        }
+        current = DecodedImage{};
+        pending--;
+    }
+
+    void upload(size_t budget)
+    {
+        DecodedImage image;
+        while (decoded.tryPop(image))
+            ready.push_back(std::move(image));
+
+        while (budget > 0)
+        {
+            if (current.texture == 0)
+            {
+                if (ready.empty())
+                    return;
+                current = std::move(ready.front());
+                ready.pop_front();
+                level = (int)current.levels.size() - 1;
+                nextRow = 0;
+                levelStarted = false;
+                if (current.levels.empty())
+                {
+                    std::cout << "Failed to load texture " << current.path << std::endl;
+                    finishImage();
+                    continue;
+                }
+                if (current.levelCount < 0)
+                {
+                    // sampling stays on the placeholder in level 0 until the smaller levels are in
+                    glState.bindTextureForUpdate(GL_TEXTURE_2D, current.texture);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+                }
+            }
+
+            if (!levelStarted)
+            {
+                startLevel();
+                levelStarted = true;
+            }
+            const MipLevel& mip = current.levels[level];
+            if (current.format == 0)
+            {
+                // blocks go up a level at a time
+                glState.bindTextureForUpdate(GL_TEXTURE_2D, current.texture);
+                UploadTextureLevel(GL_TEXTURE_2D, level, current.internalFormat, 0, 0, mip.width, mip.height,
+                                   mip.pixels.data(), mip.pixels.size());
+                budget -= std::min(budget, mip.pixels.size());
+                nextRow = mip.height;
+            }
+            else
+            {
+                const size_t rowBytes = mip.pixels.size() / mip.height;
+                int rows;
+                if (bandRows > 0)
+                {
+                    // a worker is still copying the band into the upload buffer, try again next frame
+                    if (!bandFilled.load(std::memory_order_acquire))
+                        return;
+                    rows = bandRows;
+                    bandRows = 0;
+                    glState.bindTextureForUpdate(GL_TEXTURE_2D, current.texture);
+                    pixelBuffer.upload(band, GL_TEXTURE_2D, level, 0, nextRow, mip.width, rows, current.format, current.type);
+                }
+                else
+                {
+                    const size_t maxRows = std::max<size_t>(std::min(budget, pixelBuffer.size()) / rowBytes, 1);
+                    rows = (int)std::min<size_t>(maxRows, (size_t)(mip.height - nextRow));
+                    band = pixelBuffer.reserve(rows * rowBytes);
+                    if (band.valid())
+                    {
+                        // the copy into the buffer runs on a worker, the upload follows once it is done
+                        bandRows = rows;
+                        bandFilled.store(false, std::memory_order_relaxed);
+                        jobs.submit([this, destination = band.data, source = mip.pixels.data() + nextRow * rowBytes, bytes = rows * rowBytes]
+                        {
+                            memcpy(destination, source, bytes);
+                            bandFilled.store(true, std::memory_order_release);
+                        });
+                        continue;
+                    }
+                    // no room in the upload buffer, copy out of client memory instead
+                    glState.bindTextureForUpdate(GL_TEXTURE_2D, current.texture);
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                    glTexSubImage2D(GL_TEXTURE_2D, level, 0, nextRow, mip.width, rows, current.format,
+                                    current.type, mip.pixels.data() + nextRow * rowBytes);
+                    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                }
+                nextRow += rows;
+                budget -= std::min(budget, rows * rowBytes);
+            }
+
+            if (nextRow == mip.height)
+            {
+                finishLevel();
+                if (level-- > 0)
+                    continue;
+                finishImage();
+            }
+        }
+    }
+};
+
+#endif
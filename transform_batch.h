@@ -0,0 +1,231 @@
+#ifndef TRANSFORM_BATCH_H
+#define TRANSFORM_BATCH_H
+
+#include <Eigen/Dense>
+#include "job_system.h"
+#include "simd.h"
+
+#include <cstddef>
+#include <vector>
+
+// Position, rotation and scale of many objects, one array per component, so a SIMD register
+// loads the same component of 4 (SSE2) or 8 (AVX2) consecutive objects at once.
+struct TransformBatch
+{
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ, rotationW; // unit quaternion
+    std::vector<float> scaleX, scaleY, scaleZ;
+
+    size_t size() const { return positionX.size(); }
+
+    void resize(size_t count)
+    {
+        for (std::vector<float>* component : components())
+            component->resize(count);
+    }
+
+    void set(size_t i, const Eigen::Vector3f& position, const Eigen::Quaternionf& rotation, const Eigen::Vector3f& scale)
+    {
+        positionX[i] = position.x(); positionY[i] = position.y(); positionZ[i] = position.z();
+        rotationX[i] = rotation.x(); rotationY[i] = rotation.y(); rotationZ[i] = rotation.z(); rotationW[i] = rotation.w();
+        scaleX[i] = scale.x(); scaleY[i] = scale.y(); scaleZ[i] = scale.z();
+    }
+
+private:
+    std::vector<std::vector<float>*> components()
+    {
+        return { &positionX, &positionY, &positionZ, &rotationX, &rotationY, &rotationZ, &rotationW, &scaleX, &scaleY, &scaleZ };
+    }
+};
+
+// The arithmetic of one lane group: Value holds WIDTH objects' worth of one component. The
+// kernel below is written once against these and instantiated per instruction set, so every
+// path does the same operations in the same order.
+struct ScalarTransformLanes
+{
+    using Value = float;
+    static constexpr size_t WIDTH = 1;
+    static Value load(const float* p) { return *p; }
+    static Value broadcast(float v) { return v; }
+    static Value add(Value a, Value b) { return a + b; }
+    static Value sub(Value a, Value b) { return a - b; }
+    static Value mul(Value a, Value b) { return a * b; }
+    // component k of the object goes to out[k]
+    static void store(const Value (&matrix)[16], float* out)
+    {
+        for (int k = 0; k < 16; k++)
+            out[k] = matrix[k];
+    }
+};
+
+#if defined(SIMD_SSE2)
+struct SseTransformLanes
+{
+    using Value = __m128;
+    static constexpr size_t WIDTH = 4;
+    static Value load(const float* p) { return _mm_loadu_ps(p); }
+    static Value broadcast(float v) { return _mm_set1_ps(v); }
+    static Value add(Value a, Value b) { return _mm_add_ps(a, b); }
+    static Value sub(Value a, Value b) { return _mm_sub_ps(a, b); }
+    static Value mul(Value a, Value b) { return _mm_mul_ps(a, b); }
+    // lane i of matrix[k] is component k of object i, which goes to out[i * 16 + k]
+    static void store(const Value (&matrix)[16], float* out)
+    {
+        for (int group = 0; group < 4; group++)
+        {
+            __m128 r0 = matrix[group * 4], r1 = matrix[group * 4 + 1], r2 = matrix[group * 4 + 2], r3 = matrix[group * 4 + 3];
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(out + group * 4, r0);
+            _mm_storeu_ps(out + 16 + group * 4, r1);
+            _mm_storeu_ps(out + 32 + group * 4, r2);
+            _mm_storeu_ps(out + 48 + group * 4, r3);
+        }
+    }
+};
+#endif
+
+#if defined(SIMD_AVX2)
+struct AvxTransformLanes
+{
+    using Value = __m256;
+    static constexpr size_t WIDTH = 8;
+    SIMD_AVX2_TARGET static Value load(const float* p) { return _mm256_loadu_ps(p); }
+    SIMD_AVX2_TARGET static Value broadcast(float v) { return _mm256_set1_ps(v); }
+    SIMD_AVX2_TARGET static Value add(Value a, Value b) { return _mm256_add_ps(a, b); }
+    SIMD_AVX2_TARGET static Value sub(Value a, Value b) { return _mm256_sub_ps(a, b); }
+    SIMD_AVX2_TARGET static Value mul(Value a, Value b) { return _mm256_mul_ps(a, b); }
+    // two 8x8 transposes, components 0-7 and 8-15 of the 8 objects
+    SIMD_AVX2_TARGET static void store(const Value (&matrix)[16], float* out)
+    {
+        for (int half = 0; half < 2; half++)
+        {
+            const __m256* r = matrix + half * 8;
+            const __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]), t1 = _mm256_unpackhi_ps(r[0], r[1]);
+            const __m256 t2 = _mm256_unpacklo_ps(r[2], r[3]), t3 = _mm256_unpackhi_ps(r[2], r[3]);
+            const __m256 t4 = _mm256_unpacklo_ps(r[4], r[5]), t5 = _mm256_unpackhi_ps(r[4], r[5]);
+            const __m256 t6 = _mm256_unpacklo_ps(r[6], r[7]), t7 = _mm256_unpackhi_ps(r[6], r[7]);
+            const __m256 s0 = _mm256_shuffle_ps(t0, t2, 0x44), s1 = _mm256_shuffle_ps(t0, t2, 0xEE);
+            const __m256 s2 = _mm256_shuffle_ps(t1, t3, 0x44), s3 = _mm256_shuffle_ps(t1, t3, 0xEE);
+            const __m256 s4 = _mm256_shuffle_ps(t4, t6, 0x44), s5 = _mm256_shuffle_ps(t4, t6, 0xEE);
+            const __m256 s6 = _mm256_shuffle_ps(t5, t7, 0x44), s7 = _mm256_shuffle_ps(t5, t7, 0xEE);
+            float* o = out + half * 8;
+            _mm256_storeu_ps(o + 0 * 16, _mm256_permute2f128_ps(s0, s4, 0x20));
+            _mm256_storeu_ps(o + 1 * 16, _mm256_permute2f128_ps(s1, s5, 0x20));
+            _mm256_storeu_ps(o + 2 * 16, _mm256_permute2f128_ps(s2, s6, 0x20));
+            _mm256_storeu_ps(o + 3 * 16, _mm256_permute2f128_ps(s3, s7, 0x20));
+            _mm256_storeu_ps(o + 4 * 16, _mm256_permute2f128_ps(s0, s4, 0x31));
+            _mm256_storeu_ps(o + 5 * 16, _mm256_permute2f128_ps(s1, s5, 0x31));
+            _mm256_storeu_ps(o + 6 * 16, _mm256_permute2f128_ps(s2, s6, 0x31));
+            _mm256_storeu_ps(o + 7 * 16, _mm256_permute2f128_ps(s3, s7, 0x31));
+        }
+    }
+};
+#endif
+
+// world = translation * rotation * scale and mvp = viewProjection * world for the objects from
+// begin on, a whole lane group at a time. Returns where it stopped, the caller finishes the
+// rest with narrower lanes. The rotation is built like Eigen's Quaternion::toRotationMatrix.
+SIMD_LANES_BEGIN
+template <typename Lanes>
+size_t TransformLaneGroups(const TransformBatch& batch, size_t begin, size_t end, const Eigen::Matrix4f& viewProjection,
+                           float* world, float* mvp)
+{
+    using V = typename Lanes::Value;
+    V vp[16];
+    for (int k = 0; k < 16; k++)
+        vp[k] = Lanes::broadcast(viewProjection.data()[k]);
+    const V one = Lanes::broadcast(1.0f), two = Lanes::broadcast(2.0f), zero = Lanes::broadcast(0.0f);
+
+    size_t i = begin;
+    for (; i + Lanes::WIDTH <= end; i += Lanes::WIDTH)
+    {
+        const V x = Lanes::load(&batch.rotationX[i]), y = Lanes::load(&batch.rotationY[i]);
+        const V z = Lanes::load(&batch.rotationZ[i]), w = Lanes::load(&batch.rotationW[i]);
+        const V tx = Lanes::mul(two, x), ty = Lanes::mul(two, y), tz = Lanes::mul(two, z);
+        const V twx = Lanes::mul(tx, w), twy = Lanes::mul(ty, w), twz = Lanes::mul(tz, w);
+        const V txx = Lanes::mul(tx, x), txy = Lanes::mul(ty, x), txz = Lanes::mul(tz, x);
+        const V tyy = Lanes::mul(ty, y), tyz = Lanes::mul(tz, y), tzz = Lanes::mul(tz, z);
+        const V sx = Lanes::load(&batch.scaleX[i]), sy = Lanes::load(&batch.scaleY[i]), sz = Lanes::load(&batch.scaleZ[i]);
+
+        // column major, element k is column k / 4, row k % 4
+        V m[16];
+        m[0] = Lanes::mul(Lanes::sub(one, Lanes::add(tyy, tzz)), sx);
+        m[1] = Lanes::mul(Lanes::add(txy, twz), sx);
+        m[2] = Lanes::mul(Lanes::sub(txz, twy), sx);
+        m[3] = zero;
+        m[4] = Lanes::mul(Lanes::sub(txy, twz), sy);
+        m[5] = Lanes::mul(Lanes::sub(one, Lanes::add(txx, tzz)), sy);
+        m[6] = Lanes::mul(Lanes::add(tyz, twx), sy);
+        m[7] = zero;
+        m[8] = Lanes::mul(Lanes::add(txz, twy), sz);
+        m[9] = Lanes::mul(Lanes::sub(tyz, twx), sz);
+        m[10] = Lanes::mul(Lanes::sub(one, Lanes::add(txx, tyy)), sz);
+        m[11] = zero;
+        m[12] = Lanes::load(&batch.positionX[i]);
+        m[13] = Lanes::load(&batch.positionY[i]);
+        m[14] = Lanes::load(&batch.positionZ[i]);
+        m[15] = one;
+        if (world)
+            Lanes::store(m, world + i * 16);
+        if (!mvp)
+            continue;
+
+        // the bottom row of world is 0 0 0 1, so each column is three products plus the
+        // translation column of viewProjection for the last one
+        V p[16];
+        for (int column = 0; column < 4; column++)
+        {
+            for (int row = 0; row < 4; row++)
+            {
+                V sum = Lanes::add(Lanes::add(Lanes::mul(vp[row], m[column * 4]), Lanes::mul(vp[4 + row], m[column * 4 + 1])),
+                                   Lanes::mul(vp[8 + row], m[column * 4 + 2]));
+                if (column == 3)
+                    sum = Lanes::add(sum, vp[12 + row]);
+                p[column * 4 + row] = sum;
+            }
+        }
+        Lanes::store(p, mvp + i * 16);
+    }
+    return i;
+}
+SIMD_LANES_END
+
+#if defined(SIMD_AVX2)
+SIMD_AVX2_KERNEL inline size_t TransformLaneGroupsAvx2(const TransformBatch& batch, size_t begin, size_t end,
+                                                      const Eigen::Matrix4f& viewProjection, float* world, float* mvp)
+{
+    return TransformLaneGroups<AvxTransformLanes>(batch, begin, end, viewProjection, world, mvp);
+}
+#endif
+
+// world and mvp for objects [begin, end) on the calling thread, 16 floats per object laid out
+// like Eigen::Matrix4f. Either output may be nullptr. vectorized = false runs the scalar
+// lanes only, the reference the SIMD ones are checked against.
+inline void ComputeTransformRange(const TransformBatch& batch, size_t begin, size_t end, const Eigen::Matrix4f& viewProjection,
+                                  float* world, float* mvp, bool vectorized = true)
+{
+    size_t i = begin;
+#if defined(SIMD_AVX2)
+    if (vectorized && SimdHasAvx2())
+        i = TransformLaneGroupsAvx2(batch, i, end, viewProjection, world, mvp);
+#endif
+#if defined(SIMD_SSE2)
+    if (vectorized)
+        i = TransformLaneGroups<SseTransformLanes>(batch, i, end, viewProjection, world, mvp);
+#endif
+    TransformLaneGroups<ScalarTransformLanes>(batch, i, end, viewProjection, world, mvp);
+}
+
+// the whole batch, split across the job system's threads
+inline void ComputeTransforms(JobSystem& jobs, const TransformBatch& batch, const Eigen::Matrix4f& viewProjection,
+                              float* world, float* mvp, bool vectorized = true)
+{
+    // a multiple of every lane width, and big enough that a chunk outweighs handing it out
+    constexpr size_t grain = 4096;
+    jobs.parallelFor(batch.size(), grain, [&](size_t begin, size_t end)
+    {
+        ComputeTransformRange(batch, begin, end, viewProjection, world, mvp, vectorized);
+    });
+}
+
+#endif
@@ -21,6 +21,48 @@ inline Matrix4f GetMatPerspectiveProjection(const float fovY, const float aspect
 	return translate;
 }
 
+// GetMatPerspectiveProjection with the far plane at infinity, for the same [-1,1] depth range
+inline Matrix4f GetMatPerspectiveProjectionInfinite(const float fovY, const float aspect, const float near)
+{
+	float invtan = 1. / tan(fovY * 0.5);
+	Matrix4f projection;
+	projection <<
+		invtan / aspect, 0, 0, 0,
+		0, invtan, 0, 0,
+		0, 0, -1, -2 * near,
+		0, 0, -1, 0;
+	return projection;
+}
+
+// Reversed-Z: depth 1 at the near plane and 0 at the far plane, for a [0,1] depth range
+// (glClipControl with GL_ZERO_TO_ONE). Float depth keeps most of its precision near 0, which
+// is where the distance crowds the values together, so the two cancel out.
+inline Matrix4f GetMatPerspectiveProjectionReversed(const float fovY, const float aspect, const float near, const float far)
+{
+	float invtan = 1. / tan(fovY * 0.5);
+	float range = far - near;
+	Matrix4f projection;
+	projection <<
+		invtan / aspect, 0, 0, 0,
+		0, invtan, 0, 0,
+		0, 0, near / range, far * near / range,
+		0, 0, -1, 0;
+	return projection;
+}
+
+// reversed-Z with the far plane at infinity, where depth reaches 0
+inline Matrix4f GetMatPerspectiveProjectionReversedInfinite(const float fovY, const float aspect, const float near)
+{
+	float invtan = 1. / tan(fovY * 0.5);
+	Matrix4f projection;
+	projection <<
+		invtan / aspect, 0, 0, 0,
+		0, invtan, 0, 0,
+		0, 0, 0, near,
+		0, 0, -1, 0;
+	return projection;
+}
+
 inline Matrix4f GetMatTranslation(const float dx, const float dy, const float dz)
 {
 	Matrix4f translate;
@@ -6,11 +6,10 @@ layout (location = 2) in vec2 aTexCoord;
 out vec3 vertexColor;
 out vec2 TexCoord;
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#pragma frame_constants
 void main()
 {
-	gl_Position = projection * view * model * vec4(aPos, 1.0);
+	gl_Position = viewProj * model * vec4(aPos, 1.0);
 	vertexColor = aColor;
 	TexCoord = aTexCoord;
 };
\ No newline at end of file
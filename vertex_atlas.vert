@@ -0,0 +1,19 @@
+#version 330 core
+precision mediump float;
+layout (location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aColor; 
+layout (location = 2) in vec2 aTexCoord;
+// per instance, a mat4 takes the four locations 3..6
+layout (location = 3) in mat4 aModel;
+// per instance, where the quad's image sits in the atlas: offset in xy, scale in zw
+layout (location = 7) in vec4 aAtlasRect;
+layout (location = 8) in float aAtlasLayer;
+out vec3 vertexColor;
+out vec3 AtlasCoord;
+#pragma frame_constants
+void main()
+{
+	gl_Position = viewProj * aModel * vec4(aPos, 1.0);
+	vertexColor = aColor;
+	AtlasCoord = vec3(aAtlasRect.xy + aTexCoord * aAtlasRect.zw, aAtlasLayer);
+};
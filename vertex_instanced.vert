@@ -0,0 +1,16 @@
+#version 330 core
+precision mediump float;
+layout (location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aColor; 
+layout (location = 2) in vec2 aTexCoord;
+// per instance, a mat4 takes the four locations 3..6
+layout (location = 3) in mat4 aModel;
+out vec3 vertexColor;
+out vec2 TexCoord;
+#pragma frame_constants
+void main()
+{
+	gl_Position = viewProj * aModel * vec4(aPos, 1.0);
+	vertexColor = aColor;
+	TexCoord = aTexCoord;
+};